@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 
@@ -20,6 +21,24 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* If false (default), the timer interrupts TIMER_FREQ times per
+   second at all times.
+   If true, the periodic timer is stopped while the CPU is idle.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* PIT cycles per timer tick. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Tickless idle state.  While ONESHOT_TICKS is nonzero, PIT
+   channel 0 is counting down a one-shot that expires on a tick
+   boundary ONESHOT_TICKS ticks after the last tick accounted for
+   in `ticks'.  The first ONESHOT_IDLE_TICKS of those ticks are
+   known to have passed while the idle thread was running. */
+static int64_t oneshot_ticks;
+static int64_t oneshot_idle_ticks;
+static long long oneshot_cnt;   /* # of one-shots armed. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -30,18 +49,30 @@ static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
 
-/* Added list of sleeping threads */
-struct list thread_sleep_list;
+/* Hashed timing wheel of sleeping threads.  A thread sleeping
+   until tick T waits in bucket T % TIMER_WHEEL_SIZE, so arming a
+   sleep is O(1) and each tick only examines a single bucket.  A
+   thread whose wake-up tick is one or more revolutions away stays
+   in its bucket until that tick comes around. */
+#define TIMER_WHEEL_SIZE 256
+static struct list timer_wheel[TIMER_WHEEL_SIZE];
+
+static void timer_advance (int64_t cnt, int64_t idle_cnt);
+static void timer_wake_sleepers (void);
+static bool timer_sleepers_due (int64_t tick);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void)
 {
+  int i;
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 
-  list_init (&thread_sleep_list);
+  for (i = 0; i < TIMER_WHEEL_SIZE; i++)
+    list_init (&timer_wheel[i]);
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -94,18 +125,24 @@ timer_elapsed (int64_t then)
 void
 timer_sleep (int64_t ticks)
 {
+  struct thread *t = thread_current ();
+  int64_t start = timer_ticks ();
 
   ASSERT (intr_get_level () == INTR_ON);
 
-  /* Set 'timer_sleep' for current thread. */
-  struct thread *t = thread_current ();
-  t->sleep_ticks = timer_ticks () + ticks;
-
-  /* Disable interrupts to make insertion to sleeping thread list and blocking run atomically. */
+  /* Disable interrupts to make insertion into the timing wheel and
+     blocking run atomically. */
   enum intr_level old_level = intr_disable ();
 
-  /* Insert thread to a list that contains all sleeping threads ordered by 'sleeping_ticks' */
-  list_insert_ordered (&thread_sleep_list, &t->elem, less_sleep, NULL);
+  /* Set the wake-up tick for the current thread.  A tick may have
+     passed since START was read, and that tick's bucket has already
+     been examined, so never arm for a tick that is not in the future. */
+  t->sleep_ticks = start + ticks;
+  if (t->sleep_ticks <= timer_ticks ())
+    t->sleep_ticks = timer_ticks () + 1;
+
+  /* Insert thread into the bucket of its wake-up tick. */
+  list_push_back (&timer_wheel[t->sleep_ticks % TIMER_WHEEL_SIZE], &t->elem);
 
   /* Block currently running thread, switch it's 'status' to 'THREAD_BLOCKED'. */
   thread_block ();
@@ -182,32 +219,151 @@ void
 timer_print_stats (void)
 {
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  if (timer_tickless)
+    printf ("Timer: %lld tickless idle periods\n", oneshot_cnt);
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU with nothing else to run.  In tickless mode,
+   replaces the periodic timer by a one-shot that expires on the
+   next tick at which a sleeping thread is due, or as far ahead as
+   the PIT's 16-bit counter allows, whichever comes first. */
+void
+timer_idle_enter (void)
+{
+  uint16_t remaining;
+  int64_t cnt, max_cnt;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || oneshot_ticks != 0)
+    return;
+
+  /* Start the one-shot from the next periodic tick, so that it
+     expires in phase with the ticks it replaces. */
+  remaining = pit_read_count (0, NULL);
+  max_cnt = (UINT16_MAX - remaining) / TICK_CYCLES + 1;
+  for (cnt = 1; cnt < max_cnt; cnt++)
+    if (timer_sleepers_due (ticks + cnt))
+      break;
+  if (cnt < 2)
+    return;
+
+  pit_start_one_shot (0, remaining + (cnt - 1) * TICK_CYCLES);
+  oneshot_ticks = cnt;
+  oneshot_idle_ticks = 0;
+  oneshot_cnt++;
+}
+
+/* Called by the idle thread, with interrupts off, when an
+   interrupt other than the timer's may have made some thread
+   ready.  If the one-shot armed by timer_idle_enter() has not
+   expired yet, moves its expiry up to the next tick boundary, so
+   that the ticks skipped while idle are caught up within a tick,
+   and charges those ticks to the idle thread. */
+void
+timer_idle_exit (void)
+{
+  uint16_t remaining;
+  int64_t left;
+  bool expired;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_ticks == 0)
+    return;
+
+  /* If the one-shot already expired, its interrupt is pending and
+     will account for all of its ticks. */
+  remaining = pit_read_count (0, &expired);
+  if (expired)
+    return;
+
+  /* Number of tick boundaries still ahead of the one-shot. */
+  left = DIV_ROUND_UP (remaining, TICK_CYCLES);
+  if (left > 1)
+    {
+      pit_start_one_shot (0, remaining - (left - 1) * TICK_CYCLES);
+      oneshot_ticks -= left - 1;
+    }
+  oneshot_idle_ticks = oneshot_ticks - 1;
 }
 
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
 {
-  ticks++;
-  thread_tick ();
+  int64_t cnt, idle_cnt;
+  bool expired;
+
+  profile_sample (args);
 
-  /* Iterate over all sleeping threads, unblock every thread which finishes sleeping
-     for the given duration and remove it out of sleeping threads list. */
-  struct list_elem *e = list_begin (&thread_sleep_list);
-  while (e != list_end (&thread_sleep_list))
+  if (oneshot_ticks == 0)
+    {
+      timer_advance (1, 0);
+      return;
+    }
+
+  /* A one-shot is armed but has not expired, so this is a periodic
+     tick that was already pending when the one-shot was armed. */
+  pit_read_count (0, &expired);
+  if (!expired)
+    {
+      timer_advance (1, 0);
+      return;
+    }
+
+  /* The one-shot expired.  Go back to periodic ticks and catch up
+     on every tick that the one-shot stood in for. */
+  pit_configure_channel (0, 2, TIMER_FREQ);
+  cnt = oneshot_ticks;
+  idle_cnt = oneshot_idle_ticks;
+  oneshot_ticks = oneshot_idle_ticks = 0;
+  timer_advance (cnt, idle_cnt);
+}
+
+/* Advances the clock by CNT ticks, doing the work of a timer tick
+   for each of them.  The first IDLE_CNT ticks are charged to the
+   idle thread. */
+static void
+timer_advance (int64_t cnt, int64_t idle_cnt)
+{
+  int64_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      ticks++;
+      if (i < idle_cnt)
+        thread_tick_idle ();
+      else
+        thread_tick ();
+      timer_wake_sleepers ();
+    }
+}
+
+/* Unblocks every thread in the current tick's timing wheel bucket
+   that has finished sleeping.  Threads due in a later revolution
+   of the wheel are left in place. */
+static void
+timer_wake_sleepers (void)
+{
+  struct list *bucket = &timer_wheel[ticks % TIMER_WHEEL_SIZE];
+  struct list_elem *e = list_begin (bucket);
+
+  while (e != list_end (bucket))
     {
       struct thread *t = list_entry (e,
       struct thread, elem);
 
-      /* Ignore all threads which have not finished sleeping yet. */
+      /* Ignore threads which have not finished sleeping yet. */
       if (t->sleep_ticks > ticks)
-        break;
+        {
+          e = list_next (e);
+          continue;
+        }
 
-      e = list_next (e);
-
-      /* Remove thread out of sleeping threads list. */
-      list_pop_front (&thread_sleep_list);
-      /* Unblock sleeping thread. */
+      /* Remove thread from its bucket and unblock it. */
+      e = list_remove (e);
       thread_unblock (t);
       /* Enforce preemption. */
       if (preempts (t))
@@ -215,6 +371,20 @@ timer_interrupt (struct intr_frame *args UNUSED)
     }
 }
 
+/* Returns true if some sleeping thread is due to wake up at or
+   before tick TICK and is waiting in TICK's timing wheel bucket. */
+static bool
+timer_sleepers_due (int64_t tick)
+{
+  struct list *bucket = &timer_wheel[tick % TIMER_WHEEL_SIZE];
+  struct list_elem *e;
+
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
+    if (list_entry (e, struct thread, elem)->sleep_ticks <= tick)
+      return true;
+  return false;
+}
+
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
 static bool
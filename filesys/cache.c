@@ -0,0 +1,459 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Buffer cache.
+
+   Holds the CACHE_SIZE most useful sectors of the file system
+   device in memory.  All file system access to the device goes
+   through here, so that repeated reads of inodes, directories
+   and the free map are served from memory, and partial sector
+   writes no longer need a read and a write of the whole sector.
+
+   Writes only update the cached copy and mark it dirty.  Dirty
+   sectors go to disk when they are evicted, every FLUSH_INTERVAL
+   in the background through filesys_sync(), and when the file
+   system is shut down.
+
+   Entries are replaced with the clock algorithm.
+
+   cache_readahead() queues a sector to be brought in by a
+   background thread, so that a sequential reader finds the next
+   sectors in the cache by the time it gets to them.  Requests
+   that do not fit in the queue are dropped.
+
+   cache_lock protects the assignment of sectors to entries and
+   their use counts.  Each entry's lock is held while its sector
+   is read in and while its data is being modified or written
+   out.  Readers copy data out, and writers copy data in from
+   user buffers, with the entry in use but unlocked, so that a
+   page fault on the user buffer, which may itself need the same
+   sector, cannot deadlock on it.  Such a writer reads the sector
+   in first, even if it overwrites all of it, so that nobody reads
+   it in from disk over the data being copied.  An entry in use is
+   never evicted, so its lock is free whenever its use count is
+   0.
+
+   To evict a dirty entry, lookup() claims it and marks it as being
+   evicted under cache_lock, then writes it back holding only the
+   entry's lock, so that the rest of the cache stays usable during
+   the write.  A lookup of the old sector waits until the write is
+   done. */
+
+/* Number of sectors in the cache. */
+#define CACHE_SIZE 64
+
+/* Time between background flushes of dirty sectors. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* Maximum number of queued read-ahead requests. */
+#define READAHEAD_QUEUE_SIZE 32
+
+/* Sector number of an unused entry. */
+#define NO_SECTOR ((block_sector_t) -1)
+
+/* A cached sector. */
+struct cache_entry {
+  block_sector_t sector;          /* Sector held, or NO_SECTOR. */
+  bool loaded;                    /* Has DATA been read in? */
+  bool dirty;                     /* Modified since read or written? */
+  bool accessed;                  /* Used since clock hand passed? */
+  bool evicting;                  /* Being written back to evict it? */
+  int users;                      /* # of threads using this entry. */
+  struct lock lock;               /* Serializes I/O and modification. */
+  uint8_t *data;                  /* BLOCK_SECTOR_SIZE bytes. */
+};
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;      /* Protects sector, users, hand. */
+static struct condition entry_idle; /* Signaled when users drops to 0
+                                       or an eviction ends. */
+static size_t hand;                 /* Clock hand. */
+
+/* Read-ahead queue, a ring buffer of sectors. */
+static block_sector_t readahead_queue[READAHEAD_QUEUE_SIZE];
+static size_t readahead_head;       /* Index of oldest request. */
+static size_t readahead_cnt;        /* # of queued requests. */
+static struct lock readahead_lock;  /* Protects the queue. */
+static struct condition readahead_queued; /* Signaled on new request. */
+
+/* Statistics. */
+static long long hit_cnt;           /* # of lookups found in cache. */
+static long long miss_cnt;          /* # of lookups not found. */
+static long long write_back_cnt;    /* # of dirty sectors written. */
+static long long readahead_req_cnt; /* # of read-ahead requests queued. */
+
+static thread_func flush_daemon NO_RETURN;
+static thread_func readahead_daemon NO_RETURN;
+static struct cache_entry *lookup (block_sector_t, bool load);
+static void unuse (struct cache_entry *);
+static void flush_entry (struct cache_entry *);
+static struct cache_entry *find_entry (block_sector_t);
+static struct cache_entry *choose_victim (void);
+
+/* Initializes the buffer cache and starts the threads that write
+   dirty sectors behind and read sectors ahead. */
+void
+cache_init (void)
+{
+  uint8_t *data;
+  size_t i;
+
+  data = palloc_get_multiple (0, CACHE_SIZE * BLOCK_SECTOR_SIZE / PGSIZE);
+  if (data == NULL)
+    PANIC ("cache_init: out of memory");
+
+  lock_init (&cache_lock);
+  lock_set_name (&cache_lock, "cache");
+  cond_init (&entry_idle);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      e->sector = NO_SECTOR;
+      e->loaded = e->dirty = e->accessed = e->evicting = false;
+      e->users = 0;
+      lock_init (&e->lock);
+      e->data = data + i * BLOCK_SECTOR_SIZE;
+    }
+
+  lock_init (&readahead_lock);
+  cond_init (&readahead_queued);
+
+  thread_create ("flusher", PRI_DEFAULT, flush_daemon, NULL);
+  thread_create ("readahead", PRI_DEFAULT, readahead_daemon, NULL);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within SECTOR into
+   BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = lookup (sector, true);
+  lock_release (&e->lock);
+  memcpy (buffer, e->data + ofs, size);
+  unuse (e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   offset OFS within it.  The sector reaches the disk later. */
+void
+cache_write (block_sector_t sector, const void *buffer, size_t ofs,
+             size_t size)
+{
+  struct cache_entry *e;
+  bool user = is_user_vaddr (buffer);
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* No need to read in a sector that will be overwritten, unless
+     the copy may fault (see the comment at the top). */
+  e = lookup (sector, user || size < BLOCK_SECTOR_SIZE);
+  if (user)
+    {
+      lock_release (&e->lock);
+      memcpy (e->data + ofs, buffer, size);
+      lock_acquire (&e->lock);
+    }
+  else
+    memcpy (e->data + ofs, buffer, size);
+  e->loaded = true;
+  e->dirty = true;
+  lock_release (&e->lock);
+  unuse (e);
+}
+
+/* Asks for SECTOR to be read into the cache in the background.
+   Does not wait for it. */
+void
+cache_readahead (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&readahead_lock);
+  for (i = 0; i < readahead_cnt; i++)
+    if (readahead_queue[(readahead_head + i) % READAHEAD_QUEUE_SIZE]
+        == sector)
+      break;
+  if (i == readahead_cnt && readahead_cnt < READAHEAD_QUEUE_SIZE)
+    {
+      readahead_queue[(readahead_head + readahead_cnt++)
+                      % READAHEAD_QUEUE_SIZE] = sector;
+      readahead_req_cnt++;
+      cond_signal (&readahead_queued, &readahead_lock);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Writes every dirty sector in the cache to disk. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&cache_lock);
+      if (e->sector == NO_SECTOR || !e->dirty)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->users++;
+      lock_release (&cache_lock);
+      flush_entry (e);
+    }
+}
+
+/* Brings SECTOR into the cache and keeps it there until
+   cache_unpin(). */
+void
+cache_pin (block_sector_t sector)
+{
+  struct cache_entry *e = lookup (sector, true);
+  lock_release (&e->lock);
+}
+
+/* Allows SECTOR, pinned with cache_pin(), to be evicted again. */
+void
+cache_unpin (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = find_entry (sector);
+  ASSERT (e != NULL && e->users > 0);
+  lock_release (&cache_lock);
+  unuse (e);
+}
+
+/* Writes SECTOR to disk now, if it is cached and dirty. */
+void
+cache_flush_sector (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = find_entry (sector);
+  if (e == NULL || !e->dirty)
+    {
+      lock_release (&cache_lock);
+      return;
+    }
+  e->users++;
+  lock_release (&cache_lock);
+  flush_entry (e);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %lld hits, %lld misses, %lld sectors written back, "
+          "%lld read ahead\n",
+          hit_cnt, miss_cnt, write_back_cnt, readahead_req_cnt);
+}
+
+/* Returns the entry for SECTOR, in use by the caller and with its
+   lock held, first bringing SECTOR into the cache if necessary.
+   If LOAD is true, the entry's data is valid on return;
+   otherwise, if SECTOR was not cached, the caller must overwrite
+   all of it. */
+static struct cache_entry *
+lookup (block_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector != NO_SECTOR);
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = find_entry (sector);
+      if (e != NULL && e->evicting)
+        {
+          /* Wait for the old copy to reach disk, then look
+             again. */
+          cond_wait (&entry_idle, &cache_lock);
+          continue;
+        }
+      if (e != NULL)
+        {
+          e->users++;
+          e->accessed = true;
+          hit_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          break;
+        }
+
+      /* If every entry is in use, wait for one to be released,
+         then look again, since SECTOR may have been brought in
+         meanwhile. */
+      e = choose_victim ();
+      if (e == NULL)
+        {
+          cond_wait (&entry_idle, &cache_lock);
+          continue;
+        }
+
+      /* Claim the victim.  If it is dirty, write it back without
+         the cache lock.  Lookups of its old sector wait for the
+         write, so that nobody reads a stale copy from disk. */
+      e->users++;
+      if (e->dirty)
+        {
+          e->evicting = true;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+          lock_release (&e->lock);
+          lock_acquire (&cache_lock);
+          e->evicting = false;
+          write_back_cnt++;
+          cond_broadcast (&entry_idle, &cache_lock);
+
+          /* Meanwhile SECTOR may have been brought in elsewhere,
+             or a flush may have started using the old sector.
+             Either way, look again. */
+          if (e->users > 1 || find_entry (sector) != NULL)
+            {
+              e->users--;
+              continue;
+            }
+        }
+      lock_acquire (&e->lock);
+      e->sector = sector;
+      e->loaded = e->dirty = false;
+      e->accessed = true;
+      miss_cnt++;
+      lock_release (&cache_lock);
+      break;
+    }
+
+  if (load && !e->loaded)
+    {
+      block_read (fs_device, sector, e->data);
+      e->loaded = true;
+    }
+  return e;
+}
+
+/* Releases the caller's use of entry E, whose lock the caller
+   must not hold. */
+static void
+unuse (struct cache_entry *e)
+{
+  lock_acquire (&cache_lock);
+  ASSERT (e->users > 0);
+  if (--e->users == 0)
+    cond_broadcast (&entry_idle, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes E, which the caller is using, to disk if it is dirty,
+   and stops using it. */
+static void
+flush_entry (struct cache_entry *e)
+{
+  lock_acquire (&e->lock);
+  if (e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      write_back_cnt++;
+    }
+  lock_release (&e->lock);
+  unuse (e);
+}
+
+/* Returns the entry holding SECTOR, or a null pointer if SECTOR
+   is not cached. */
+static struct cache_entry *
+find_entry (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Advances the clock hand to an entry that is not in use and has
+   not been accessed since the hand last passed it, and returns
+   it.  Returns a null pointer if every entry is in use. */
+static struct cache_entry *
+choose_victim (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[hand];
+
+      hand = (hand + 1) % CACHE_SIZE;
+      if (e->users > 0)
+        continue;
+      if (e->accessed)
+        e->accessed = false;
+      else
+        return e;
+    }
+  return NULL;
+}
+
+/* Brings the sectors queued by cache_readahead() into the cache. */
+static void
+readahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+      struct cache_entry *e;
+
+      lock_acquire (&readahead_lock);
+      while (readahead_cnt == 0)
+        cond_wait (&readahead_queued, &readahead_lock);
+      sector = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_QUEUE_SIZE;
+      readahead_cnt--;
+      lock_release (&readahead_lock);
+
+      e = lookup (sector, true);
+      lock_release (&e->lock);
+      unuse (e);
+    }
+}
+
+/* Writes dirty sectors behind, together with the free map, every
+   FLUSH_INTERVAL ticks. */
+static void
+flush_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_INTERVAL);
+      filesys_sync ();
+    }
+}
@@ -1,33 +1,60 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/block.h"
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/kmem.h"
+
+/* Read-ahead window limits, in bytes. */
+#define READAHEAD_MIN (2 * BLOCK_SECTOR_SIZE)
+#define READAHEAD_MAX (16 * BLOCK_SECTOR_SIZE)
 
 /* An open file. */
 struct file {
   struct inode *inode;        /* File's inode. */
   off_t pos;                  /* Current position. */
   bool deny_write;            /* Has file_deny_write() been called? */
+
+  /* Read-ahead state.  file_read() treats a read that starts where
+     the previous one ended as part of a sequential stream, and
+     keeps the RA_WINDOW bytes after it on their way into the
+     buffer cache, doubling the window on each sequential read. */
+  off_t ra_next;              /* Where a sequential read would start,
+                                 -1 after a seek. */
+  off_t ra_window;            /* Bytes to read ahead, 0 if not sequential. */
+  off_t ra_end;               /* End of bytes already requested. */
 };
 
+/* Cache of open files. */
+static struct kmem_cache file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void)
+{
+  kmem_cache_init (&file_cache, "file", sizeof (struct file), NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode)
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (&file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_window = 0;
+      file->ra_end = 0;
       return file;
     }
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (&file_cache, file);
       return NULL;
     }
 }
@@ -48,7 +75,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file);
+      kmem_cache_free (&file_cache, file);
     }
 }
 
@@ -67,8 +94,39 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read;
+
+  if (file->pos == file->ra_next)
+    {
+      file->ra_window = file->ra_window * 2;
+      if (file->ra_window < READAHEAD_MIN)
+        file->ra_window = READAHEAD_MIN;
+      else if (file->ra_window > READAHEAD_MAX)
+        file->ra_window = READAHEAD_MAX;
+    }
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+
+  bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->ra_next = file->pos;
+
+  /* Request whatever part of the window after this read has not
+     been requested already. */
+  if (file->ra_window > 0 && bytes_read == size)
+    {
+      off_t start = file->ra_end > file->pos ? file->ra_end : file->pos;
+      off_t end = file->pos + file->ra_window;
+
+      if (start < end)
+        {
+          inode_readahead (file->inode, end - start, start);
+          file->ra_end = end;
+        }
+    }
   return bytes_read;
 }
 
@@ -86,10 +144,10 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
-   Advances FILE's position by the number of bytes read. */
+   which may be less than SIZE if the disk is full or the file
+   reaches its maximum size.
+   Writing past end of file extends the file.
+   Advances FILE's position by the number of bytes written. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size)
 {
@@ -101,9 +159,11 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full or the file
+   reaches its maximum size.
+   Writing past end of file extends the file, leaving any gap
+   between the old end of file and FILE_OFS as a hole that reads
+   as zeros.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -139,6 +199,17 @@ file_allow_write (struct file *file)
     }
 }
 
+/* Allocates disk space for the first LENGTH bytes of FILE, as
+   contiguously as possible, so that writing them later does not
+   scatter them across the disk.  Does not change FILE's size.
+   Returns true if successful, false if the disk is full. */
+bool
+file_preallocate (struct file *file, off_t length)
+{
+  ASSERT (file != NULL);
+  return inode_preallocate (file->inode, length);
+}
+
 /* Returns the size of FILE in bytes. */
 off_t
 file_length (struct file *file)
@@ -148,13 +219,18 @@ file_length (struct file *file)
 }
 
 /* Sets the current position in FILE to NEW_POS bytes from the
-   start of the file. */
+   start of the file.  Ends any sequential run of reads, so the
+   read-ahead window starts over once reads are sequential
+   again. */
 void
 file_seek (struct file *file, off_t new_pos)
 {
   ASSERT (file != NULL);
   ASSERT (new_pos >= 0);
   file->pos = new_pos;
+  file->ra_next = -1;
+  file->ra_window = 0;
+  file->ra_end = 0;
 }
 
 /* Returns the current position in FILE as a byte offset from the
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -25,18 +26,36 @@ void filesys_release_external_lock ()
   lock_release (&file_system);
 }
 
+/* Acquires the file system lock if it is free, without waiting.
+   Returns true if successful, false if another thread holds it. */
+bool
+filesys_try_acquire_external_lock (void)
+{
+  return lock_try_acquire (&file_system);
+}
+
+/* Returns true if the running thread holds the file system lock. */
+bool
+filesys_external_lock_held (void)
+{
+  return lock_held_by_current_thread (&file_system);
+}
+
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
 void
 filesys_init (bool format)
 {
   lock_init (&file_system); /* initialize the lock */
+  lock_set_name (&file_system, "file_system");
 
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  file_init ();
   free_map_init ();
 
   if (format)
@@ -51,6 +70,16 @@ void
 filesys_done (void)
 {
   free_map_close ();
+  cache_flush ();
+}
+
+/* Writes the free map and all dirty cached sectors to disk. */
+void
+filesys_sync (void)
+{
+  lock_acquire (&file_system);
+  free_map_sync ();
+  lock_release (&file_system);
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -13,10 +13,13 @@ struct block *fs_device;
 
 void filesys_acquire_external_lock (void);
 void filesys_release_external_lock (void);
+bool filesys_try_acquire_external_lock (void);
+bool filesys_external_lock_held (void);
 
 
 void filesys_init (bool format);
 void filesys_done (void);
+void filesys_sync (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
@@ -1,12 +1,57 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+
+/* The disk is divided into allocation groups of GROUP_SECTORS
+   sectors, and the number of free sectors in each is kept up to
+   date alongside the bitmap.
+
+   An allocation with a goal sector, such as the next block of a
+   growing file, takes the first free run at or after the goal, so
+   that a file's blocks stay together.  An allocation without one,
+   such as a new inode, goes to the current group and moves on to
+   the next group once fewer than GROUP_RESERVE sectors are left
+   there.  The reserve is kept for the files already in the group
+   to grow into.
+
+   Changes to the free map are not written to the free map file
+   right away.  free_map_write() writes just the sectors of the
+   file that changed, straight to disk.  The inode layer calls it
+   before it lets an inode or indirect block that points to newly
+   allocated sectors into the buffer cache where it could be
+   evicted, and free_map_sync() calls it before flushing the rest
+   of the cache, so that such a block never reaches disk pointing
+   to a sector that the free map on disk still shows as free.  For
+   the same reason, sectors released with free_map_release() only
+   become free after the next sync, once the inodes that let go of
+   them are on disk. */
+#define GROUP_SECTORS 1024
+#define GROUP_RESERVE (GROUP_SECTORS / 4)
+
+/* Number of sectors whose bits share a sector of the free map
+   file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *changed;       /* Free map file sectors to write. */
+static struct bitmap *released;      /* Sectors released since last sync. */
+
+static size_t group_cnt;             /* Number of allocation groups. */
+static size_t *group_free;           /* Free sectors in each group. */
+static block_sector_t next_sector;   /* Goal for allocations without one. */
+
+static void count_free (void);
+static void set_sectors (block_sector_t, size_t cnt, bool used);
+static block_sector_t choose_goal (void);
+static void write_changed (void);
+static void free_released (void);
 
 /* Initializes the free map. */
 void
@@ -17,36 +62,96 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  changed = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                         BLOCK_SECTOR_SIZE));
+  released = bitmap_create (bitmap_size (free_map));
+  if (changed == NULL || released == NULL)
+    PANIC ("free map creation failed");
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("allocation group creation failed");
+  count_free ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  if (!free_map_allocate_near (cnt, choose_goal (), sectorp))
+    return false;
+  next_sector = *sectorp + cnt;
+  return true;
+}
+
+/* Allocates CNT consecutive sectors from the free map, preferring
+   the first run at or after GOAL, and stores the first into
+   *SECTORP.
+   If there is not enough space, but sectors have been released
+   since the last sync, syncs to free them and tries again.
+   Returns true if successful, false if not enough consecutive
+   sectors were available. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t goal,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  sector = bitmap_scan_and_flip (free_map, goal, cnt, false);
+  if (sector == BITMAP_ERROR && goal > 0)
+    sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector == BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
+      if (bitmap_scan (released, 0, 1, true) == BITMAP_ERROR)
+        return false;
+      free_map_sync ();
+      return free_map_allocate_near (cnt, goal, sectorp);
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+
+  set_sectors (sector, cnt, true);
+  *sectorp = sector;
+  return true;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use, once
+   the file system has been synced. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  ASSERT (bitmap_none (released, sector, cnt));
+  bitmap_set_multiple (released, sector, cnt, true);
+}
+
+/* Writes the changed parts of the free map to disk, then every
+   other dirty sector in the buffer cache, and finally frees the
+   sectors released since the last sync.  Those show up on disk
+   at the next sync. */
+void
+free_map_sync (void)
+{
+  free_map_write ();
+  cache_flush ();
+  free_released ();
+}
+
+/* Writes the sectors of the free map file that have changed to
+   disk now. */
+void
+free_map_write (void)
+{
+  if (free_map_file != NULL)
+    {
+      write_changed ();
+      inode_flush (file_get_inode (free_map_file));
+    }
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +163,17 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_free ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void)
 {
+  free_map_sync ();
+  write_changed ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -82,4 +191,107 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (changed, false);
+}
+
+/* Recomputes the free sector count of every allocation group
+   from the bitmap. */
+static void
+count_free (void)
+{
+  size_t i;
+
+  for (i = 0; i < group_cnt; i++)
+    {
+      size_t start = i * GROUP_SECTORS;
+      size_t cnt = bitmap_size (free_map) - start;
+
+      if (cnt > GROUP_SECTORS)
+        cnt = GROUP_SECTORS;
+      group_free[i] = bitmap_count (free_map, start, cnt, false);
+    }
+}
+
+/* Accounts for the CNT sectors starting at SECTOR, which have just
+   been marked USED or free in the bitmap, in the group counts and
+   the set of changed free map file sectors. */
+static void
+set_sectors (block_sector_t sector, size_t cnt, bool used)
+{
+  while (cnt > 0)
+    {
+      size_t group = sector / GROUP_SECTORS;
+      size_t group_left = GROUP_SECTORS - sector % GROUP_SECTORS;
+      size_t n = cnt < group_left ? cnt : group_left;
+
+      if (used)
+        group_free[group] -= n;
+      else
+        group_free[group] += n;
+      bitmap_set_multiple (changed, sector / BITS_PER_SECTOR,
+                           (sector + n - 1) / BITS_PER_SECTOR
+                           - sector / BITS_PER_SECTOR + 1, true);
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Returns the goal sector for an allocation that does not have
+   one of its own: the next sector in the current group, or the
+   start of the next group that still has more than its reserve
+   free. */
+static block_sector_t
+choose_goal (void)
+{
+  size_t group = next_sector / GROUP_SECTORS;
+  size_t i;
+
+  if (group < group_cnt && group_free[group] > GROUP_RESERVE)
+    return next_sector;
+  for (i = 1; i < group_cnt; i++)
+    {
+      size_t g = (group + i) % group_cnt;
+      if (group_free[g] > GROUP_RESERVE)
+        {
+          next_sector = g * GROUP_SECTORS;
+          return next_sector;
+        }
+    }
+  return next_sector;
+}
+
+/* Writes the sectors of the free map file that have changed since
+   they were last written into the buffer cache. */
+static void
+write_changed (void)
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (changed); i++)
+    if (bitmap_test (changed, i))
+      {
+        if (!bitmap_write_range (free_map, free_map_file,
+                                 i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+          PANIC ("can't write free map");
+        bitmap_reset (changed, i);
+      }
+}
+
+/* Frees the sectors released since the last sync. */
+static void
+free_released (void)
+{
+  size_t start = 0;
+
+  while ((start = bitmap_scan (released, start, 1, true)) != BITMAP_ERROR)
+    {
+      size_t end = bitmap_scan (released, start, 1, false);
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (released);
+
+      bitmap_set_multiple (released, start, end - start, false);
+      bitmap_set_multiple (free_map, start, end - start, false);
+      set_sectors (start, end - start, false);
+      start = end;
+    }
 }
@@ -3,20 +3,45 @@
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/kmem.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of direct block pointers in an inode. */
+#define DIRECT_CNT 124
+
+/* Number of block pointers in an indirect block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Block pointer value for a sector that has not been allocated.
+   Sector 0 holds the free map inode, so it is never a data or
+   indirect block. */
+#define UNALLOCATED 0
+
+/* Maximum number of indirect blocks held in the cache at once by
+   hold_sector(). */
+#define HELD_MAX 8
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The first DIRECT_CNT sectors of data are found through DIRECT,
+   the next PTRS_PER_SECTOR through the indirect block INDIRECT,
+   and the rest through the indirect blocks listed in the doubly
+   indirect block DOUBLY_INDIRECT.  Data and indirect blocks are
+   allocated when first written, so a pointer may be UNALLOCATED
+   anywhere in a file; such holes read as zeros. */
 struct inode_disk {
-  block_sector_t start;               /* First data sector. */
   off_t length;                       /* File size in bytes. */
   unsigned magic;                     /* Magic number. */
-  uint32_t unused[125];               /* Not used. */
+  block_sector_t direct[DIRECT_CNT];  /* Direct blocks. */
+  block_sector_t indirect;            /* Indirect block. */
+  block_sector_t doubly_indirect;     /* Doubly indirect block. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -37,29 +62,60 @@ struct inode {
   struct inode_disk data;             /* Inode content. */
 };
 
+static block_sector_t index_to_sector (struct inode_disk *, size_t idx,
+                                       block_sector_t goal, bool allocate);
+static bool preallocate (struct inode_disk *, size_t sectors,
+                         block_sector_t goal);
+static bool allocate_sector (block_sector_t *, block_sector_t goal);
+static void release_sectors (block_sector_t, int level);
+static void release_data (const struct inode_disk *);
+static void hold_sector (block_sector_t);
+static void commit_allocations (void);
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   Returns UNALLOCATED if POS falls in a hole, unless ALLOCATE is
+   true, in which case the sector is allocated.  Also returns
+   UNALLOCATED if allocation fails or POS is beyond the largest
+   possible file.
+   A new sector is placed right after the one before it in the
+   file, if possible, or else after the inode. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+byte_to_sector (struct inode *inode, off_t pos, bool allocate)
 {
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t goal = UNALLOCATED;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  ASSERT (pos >= 0);
+
+  if (allocate && idx > 0)
+    goal = index_to_sector (&inode->data, idx - 1, 0, false);
+  goal = goal != UNALLOCATED ? goal + 1 : inode->sector + 1;
+  return index_to_sector (&inode->data, idx, goal, allocate);
 }
 
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Cache of in-memory inodes. */
+static struct kmem_cache inode_cache;
+
+/* Indirect blocks that point to sectors allocated since the free
+   map was last written.  They stay in the buffer cache, so that
+   they cannot reach disk before the free map does, until
+   commit_allocations() writes it.  An inode that points to such
+   sectors is only written to the cache after that, too. */
+static block_sector_t held_sectors[HELD_MAX];
+static size_t held_cnt;
+
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
   list_init (&open_inodes);
+  kmem_cache_init (&inode_cache, "inode", sizeof (struct inode), NULL);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -82,22 +138,15 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start))
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0)
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-
-              for (i = 0; i < sectors; i++)
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true;
-        }
+      success = preallocate (disk_inode, bytes_to_sectors (length),
+                             sector + 1);
+      commit_allocations ();
+      if (success)
+        cache_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+      else
+        release_data (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -126,7 +175,7 @@ inode_open (block_sector_t sector)
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (&inode_cache);
   if (inode == NULL)
     return NULL;
 
@@ -136,7 +185,7 @@ inode_open (block_sector_t sector)
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
   return inode;
 }
 
@@ -176,11 +225,10 @@ inode_close (struct inode *inode)
       if (inode->removed)
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length));
+          release_data (&inode->data);
         }
 
-      free (inode);
+      kmem_cache_free (&inode_cache, inode);
     }
 }
 
@@ -201,12 +249,11 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0)
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -219,47 +266,73 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
+      if (sector_idx != UNALLOCATED)
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs,
+                    chunk_size);
       else
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+        memset (buffer + bytes_read, 0, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
+/* Starts reading the sectors that hold the SIZE bytes of INODE
+   starting at OFFSET into the buffer cache in the background,
+   as far as they are within the file. */
+void
+inode_readahead (struct inode *inode, off_t size, off_t offset)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  offset -= offset % BLOCK_SECTOR_SIZE;
+  for (; offset < end; offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset, false);
+      if (sector != UNALLOCATED)
+        cache_readahead (sector);
+    }
+}
+
+/* Allocates every sector of INODE's first LENGTH bytes that has
+   not been allocated yet, as contiguously as possible, without
+   changing INODE's length.  For writers that know how large a
+   file will become.
+   Returns true if successful, false if the disk is full, in which
+   case some of the sectors may have been allocated. */
+bool
+inode_preallocate (struct inode *inode, off_t length)
+{
+  bool success;
+
+  ASSERT (length >= 0);
+
+  success = preallocate (&inode->data, bytes_to_sectors (length),
+                         inode->sector + 1);
+  commit_allocations ();
+  cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  return success;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk is full or the file reaches its
+   maximum size.
+   A write past end of file extends the inode.  Sectors between
+   the old end of file and OFFSET are left as holes. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool disk_inode_changed = false;
 
   if (inode->deny_write_cnt)
     return 0;
@@ -267,55 +340,64 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   while (size > 0)
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+      int chunk_size = size < sector_left ? size : sector_left;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else
+      if (sector_idx == UNALLOCATED)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left)
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          /* Even if this fails, an indirect block may have been
+             allocated on the way. */
+          sector_idx = byte_to_sector (inode, offset, true);
+          disk_inode_changed = true;
+          if (sector_idx == UNALLOCATED)
+            break;
         }
 
+      cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                   chunk_size);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  if (offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      disk_inode_changed = true;
+    }
+  if (disk_inode_changed)
+    {
+      commit_allocations ();
+      cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    }
 
   return bytes_written;
 }
 
+/* Writes INODE and all of its data to disk now, rather than
+   whenever the buffer cache gets to them. */
+void
+inode_flush (struct inode *inode)
+{
+  off_t ofs;
+
+  cache_flush_sector (inode->sector);
+  for (ofs = 0; ofs < inode->data.length; ofs += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, ofs, false);
+      if (sector != UNALLOCATED)
+        cache_flush_sector (sector);
+    }
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -342,3 +424,162 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Returns the sector that holds sector IDX of the data of
+   DISK_INODE.
+   Returns UNALLOCATED if that sector, or an indirect block on the
+   way to it, has not been allocated, unless ALLOCATE is true, in
+   which case they are allocated, as near GOAL as possible.  Also
+   returns UNALLOCATED if allocation fails or IDX is beyond the
+   largest possible file. */
+static block_sector_t
+index_to_sector (struct inode_disk *disk_inode, size_t idx,
+                 block_sector_t goal, bool allocate)
+{
+  block_sector_t *slot;
+  block_sector_t sector;
+  int level;
+
+  /* Find the pointer in the inode that leads to IDX and the number
+     of indirect blocks between it and the data. */
+  if (idx < DIRECT_CNT)
+    {
+      slot = &disk_inode->direct[idx];
+      level = 0;
+    }
+  else if ((idx -= DIRECT_CNT) < PTRS_PER_SECTOR)
+    {
+      slot = &disk_inode->indirect;
+      level = 1;
+    }
+  else if ((idx -= PTRS_PER_SECTOR) < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      slot = &disk_inode->doubly_indirect;
+      level = 2;
+    }
+  else
+    return UNALLOCATED;
+
+  if (*slot == UNALLOCATED
+      && (!allocate || !allocate_sector (slot, goal)))
+    return UNALLOCATED;
+  sector = *slot;
+
+  /* Walk down through the indirect blocks. */
+  while (level-- > 0)
+    {
+      size_t span = level > 0 ? PTRS_PER_SECTOR : 1;
+      size_t ofs = idx / span * sizeof sector;
+      block_sector_t next;
+
+      idx %= span;
+      cache_read (sector, &next, ofs, sizeof next);
+      if (next == UNALLOCATED)
+        {
+          if (!allocate || !allocate_sector (&next, goal))
+            return UNALLOCATED;
+          hold_sector (sector);
+          cache_write (sector, &next, ofs, sizeof next);
+        }
+      sector = next;
+    }
+  return sector;
+}
+
+/* Allocates the first SECTORS sectors of DISK_INODE's data that
+   are not allocated yet, each after the one before it, starting
+   near GOAL.  Returns true if successful, false if the disk is
+   full. */
+static bool
+preallocate (struct inode_disk *disk_inode, size_t sectors,
+             block_sector_t goal)
+{
+  size_t i;
+
+  for (i = 0; i < sectors; i++)
+    {
+      block_sector_t sector = index_to_sector (disk_inode, i, goal, true);
+      if (sector == UNALLOCATED)
+        return false;
+      goal = sector + 1;
+    }
+  return true;
+}
+
+/* Allocates a sector, as near GOAL as possible, fills it with
+   zeros and stores its number into *SECTORP.  Returns true if
+   successful, false if the disk is full. */
+static bool
+allocate_sector (block_sector_t *sectorp, block_sector_t goal)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate_near (1, goal, sectorp))
+    return false;
+  cache_write (*sectorp, zeros, 0, BLOCK_SECTOR_SIZE);
+  return true;
+}
+
+/* Releases SECTOR, which is LEVEL levels of indirect blocks above
+   the data, together with every sector below it. */
+static void
+release_sectors (block_sector_t sector, int level)
+{
+  if (sector == UNALLOCATED)
+    return;
+
+  if (level > 0)
+    {
+      size_t i;
+
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        {
+          block_sector_t next;
+
+          cache_read (sector, &next, i * sizeof next, sizeof next);
+          release_sectors (next, level - 1);
+        }
+    }
+  free_map_release (sector, 1);
+}
+
+/* Releases all the data and indirect blocks of DISK_INODE. */
+static void
+release_data (const struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    release_sectors (disk_inode->direct[i], 0);
+  release_sectors (disk_inode->indirect, 1);
+  release_sectors (disk_inode->doubly_indirect, 2);
+}
+
+/* Keeps indirect block SECTOR, which is about to point to a newly
+   allocated sector, in the buffer cache until the next
+   commit_allocations().  If too many blocks are held already,
+   commits first. */
+static void
+hold_sector (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < held_cnt; i++)
+    if (held_sectors[i] == sector)
+      return;
+  if (held_cnt == HELD_MAX)
+    commit_allocations ();
+  cache_pin (sector);
+  held_sectors[held_cnt++] = sector;
+}
+
+/* Writes the free map to disk, so that it shows every sector
+   allocated so far as in use, then lets the indirect blocks held
+   by hold_sector() be evicted again. */
+static void
+commit_allocations (void)
+{
+  free_map_write ();
+  while (held_cnt > 0)
+    cache_unpin (held_sectors[--held_cnt]);
+}
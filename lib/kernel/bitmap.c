@@ -23,10 +23,16 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   Every bit below FREE_HINT is known to be true, so searches for
+   false bits, which is how the page allocator and the free map
+   look for free space, can skip over the full prefix of the
+   bitmap instead of starting over at bit 0 each time. */
 struct bitmap {
   size_t bit_cnt;     /* Number of bits. */
   elem_type *bits;    /* Elements that represent bits. */
+  size_t free_hint;   /* All bits below this one are true. */
 };
 
 /* Returns the index of the element that contains the bit
@@ -59,6 +65,80 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns an elem_type in which the bits at and above BIT_IDX's
+   position in its element are turned on. */
+static inline elem_type
+high_mask (size_t bit_idx)
+{
+  return (elem_type) -1 << (bit_idx % ELEM_BITS);
+}
+
+/* Returns element IDX of B with its bits inverted if VALUE is
+   false, so that bits set to VALUE read as 1. */
+static inline elem_type
+elem_match (const struct bitmap *b, size_t idx, bool value)
+{
+  return value ? b->bits[idx] : ~b->bits[idx];
+}
+
+/* Returns the number of bits set in X. */
+static inline size_t
+elem_popcount (elem_type x)
+{
+  /* GCC's __builtin_popcount() may call into libgcc, which the
+     kernel is not linked with, so count bits in parallel. */
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+
+/* Atomically sets the bits in MASK in element IDX of B. */
+static inline void
+elem_or (struct bitmap *b, size_t idx, elem_type mask)
+{
+  /* This is equivalent to `b->bits[idx] |= mask' except that it
+     is guaranteed to be atomic on a uniprocessor machine.  See
+     the description of the OR instruction in [IA32-v2b]. */
+  asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+}
+
+/* Atomically clears the bits in MASK in element IDX of B. */
+static inline void
+elem_and_not (struct bitmap *b, size_t idx, elem_type mask)
+{
+  /* This is equivalent to `b->bits[idx] &= ~mask' except that it
+     is guaranteed to be atomic on a uniprocessor machine.  See
+     the description of the AND instruction in [IA32-v2a]. */
+  asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+}
+
+/* Returns the index of the first bit in B between START and END,
+   exclusive, that is set to VALUE, or END if there is none.
+   Examines a whole element at a time, locating a matching bit
+   within an element with a single bit-scan instruction. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  size_t idx;
+  elem_type x;
+
+  if (start >= end)
+    return end;
+
+  idx = elem_idx (start);
+  x = elem_match (b, idx, value) & high_mask (start);
+  while (x == 0)
+    {
+      if (++idx >= elem_cnt (end))
+        return end;
+      x = elem_match (b, idx, value);
+    }
+
+  start = idx * ELEM_BITS + __builtin_ctzl (x);
+  return start < end ? start : end;
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -82,6 +162,7 @@ bitmap_create (size_t bit_cnt)
     {
       b->bit_cnt = bit_cnt;
       b->bits = malloc (byte_cnt (bit_cnt));
+      b->free_hint = 0;
       if (b->bits != NULL || bit_cnt == 0)
         {
           bitmap_set_all (b, false);
@@ -104,6 +185,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->free_hint = 0;
   bitmap_set_all (b, false);
   return b;
 }
@@ -156,26 +238,16 @@ bitmap_set (struct bitmap *b, size_t idx, bool value)
 void
 bitmap_mark (struct bitmap *b, size_t bit_idx)
 {
-  size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
-
-  /* This is equivalent to `b->bits[idx] |= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the OR instruction in [IA32-v2b]. */
-  asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  elem_or (b, elem_idx (bit_idx), bit_mask (bit_idx));
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
 void
 bitmap_reset (struct bitmap *b, size_t bit_idx)
 {
-  size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
-
-  /* This is equivalent to `b->bits[idx] &= ~mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the AND instruction in [IA32-v2a]. */
-  asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  elem_and_not (b, elem_idx (bit_idx), bit_mask (bit_idx));
+  if (bit_idx < b->free_hint)
+    b->free_hint = bit_idx;
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -191,6 +263,8 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  if (bit_idx < b->free_hint)
+    b->free_hint = bit_idx;
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -213,18 +287,39 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, but the bits as a whole
+   are not. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i;
+  size_t end = start + cnt;
+  size_t idx;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  if (cnt == 0)
+    return;
+  if (!value && start < b->free_hint)
+    b->free_hint = start;
+
+  for (idx = elem_idx (start); idx < elem_cnt (end); idx++)
+    {
+      elem_type mask = (elem_type) -1;
+      if (idx == elem_idx (start))
+        mask &= high_mask (start);
+      if (idx == elem_idx (end - 1))
+        mask &= ~high_mask (end - 1) | bit_mask (end - 1);
+
+      if (mask == (elem_type) -1)
+        b->bits[idx] = value ? mask : 0;
+      else if (value)
+        elem_or (b, idx, mask);
+      else
+        elem_and_not (b, idx, mask);
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,16 +327,26 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t idx, value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
+  if (cnt == 0)
+    return 0;
+
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  for (idx = elem_idx (start); idx < elem_cnt (end); idx++)
+    {
+      elem_type x = elem_match (b, idx, value);
+      if (idx == elem_idx (start))
+        x &= high_mask (start);
+      if (idx == elem_idx (end - 1))
+        x &= ~high_mask (end - 1) | bit_mask (end - 1);
+      value_cnt += elem_popcount (x);
+    }
   return value_cnt;
 }
 
@@ -250,16 +355,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t i;
-
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -298,15 +398,29 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt)
+  if (cnt > b->bit_cnt - start)
+    return BITMAP_ERROR;
+  if (cnt == 0)
+    return start;
+  if (!value && start < b->free_hint)
+    start = b->free_hint;
+
+  /* Find the next bit set to VALUE, then check whether the CNT - 1
+     bits after it match too.  If not, resume the search after the
+     first bit that does not match. */
+  for (;;)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i;
+      size_t end;
+
+      start = find_next (b, start, b->bit_cnt, value);
+      if (start >= b->bit_cnt || cnt > b->bit_cnt - start)
+        return BITMAP_ERROR;
+
+      end = find_next (b, start, start + cnt, !value);
+      if (end == start + cnt)
+        return start;
+      start = end;
     }
-  return BITMAP_ERROR;
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -320,8 +434,18 @@ size_t
 bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
   size_t idx = bitmap_scan (b, start, cnt, value);
+
+  /* Bits below the first false bit at or after the hint are all
+     true, so the hint can move up to it. */
+  if (!value && start <= b->free_hint)
+    b->free_hint = find_next (b, b->free_hint, b->bit_cnt, false);
+
   if (idx != BITMAP_ERROR)
-    bitmap_set_multiple (b, idx, cnt, !value);
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      if (!value && idx == b->free_hint)
+        b->free_hint = idx + cnt;
+    }
   return idx;
 }
 
@@ -346,6 +470,7 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      b->free_hint = 0;
     }
   return success;
 }
@@ -358,6 +483,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B's file representation that start at
+   byte offset OFS to the same place in FILE, stopping at the end
+   of B.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t ofs, size_t size)
+{
+  size_t total = byte_cnt (b->bit_cnt);
+
+  if (ofs >= total)
+    return true;
+  if (size > total - ofs)
+    size = total - ofs;
+  return (file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+          == (off_t) size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
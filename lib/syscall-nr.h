@@ -27,7 +27,11 @@ enum {
   SYS_MKDIR,                  /* Create a directory. */
   SYS_READDIR,                /* Reads a directory entry. */
   SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-  SYS_INUMBER                 /* Returns the inode number for a fd. */
+  SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+  /* Extensions. */
+  SYS_FORK,                   /* Duplicate this process. */
+  SYS_PREALLOCATE             /* Allocate disk space for a file. */
 };
 
 #endif /* lib/syscall-nr.h */
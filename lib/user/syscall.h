@@ -45,4 +45,8 @@ void halt (void) NO_RETURN;
                  bool isdir (int fd);
                  int inumber (int fd);
 
+/* Extensions. */
+                 pid_t fork (void);
+                 bool preallocate (int fd, unsigned length);
+
 #endif /* lib/user/syscall.h */
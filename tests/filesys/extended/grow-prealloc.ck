@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-prealloc) begin
+(grow-prealloc) create "testfile"
+(grow-prealloc) open "testfile"
+(grow-prealloc) preallocate "testfile"
+(grow-prealloc) size of "testfile" is still 0
+(grow-prealloc) write "testfile"
+(grow-prealloc) close "testfile"
+(grow-prealloc) open "testfile" for verification
+(grow-prealloc) verified contents of "testfile"
+(grow-prealloc) close "testfile"
+(grow-prealloc) end
+EOF
+pass;
@@ -0,0 +1,157 @@
+/* Test program for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan(), bitmap_count() and bitmap_contains()
+   against bit-at-a-time versions on large, fragmented bitmaps,
+   then measures how many scans per second each size of request
+   sustains, and how fast a bitmap fills up one bit at a time.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Number of bits in the bitmaps we test. */
+static const size_t sizes[] = {1024, 16384, 131072};
+
+/* Number of consecutive bits requested by scans. */
+static const size_t cnts[] = {1, 4, 16, 64};
+
+/* Percentage of bits set in a fragmented bitmap. */
+#define FILL_PERCENT 90
+
+/* Number of scans timed for each bitmap size and request size. */
+#define SCAN_CNT 2000
+
+static void fragment (struct bitmap *);
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt,
+                         bool);
+static void verify (const struct bitmap *);
+static void time_scans (const struct bitmap *, size_t cnt);
+static void time_fill (size_t size);
+
+/* Test and time the bitmap implementation. */
+void
+test (void)
+{
+  size_t i, j;
+
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      struct bitmap *b = bitmap_create (sizes[i]);
+      ASSERT (b != NULL);
+
+      fragment (b);
+      verify (b);
+      printf ("%zu bits, %zu set:\n", sizes[i],
+              bitmap_count (b, 0, sizes[i], true));
+      for (j = 0; j < sizeof cnts / sizeof *cnts; j++)
+        time_scans (b, cnts[j]);
+      time_fill (sizes[i]);
+
+      bitmap_destroy (b);
+    }
+  printf ("done\n");
+}
+
+/* Sets about FILL_PERCENT percent of the bits in B at random. */
+static void
+fragment (struct bitmap *b)
+{
+  size_t i;
+
+  bitmap_set_all (b, false);
+  for (i = 0; i < bitmap_size (b); i++)
+    if (random_ulong () % 100 < FILL_PERCENT)
+      bitmap_mark (b, i);
+}
+
+/* Returns the first group of CNT bits in B at or after START that
+   are all VALUE, testing one bit at a time. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, j;
+
+  for (i = start; i + cnt <= bitmap_size (b); i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j) != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Checks the bulk operations on B against bit-at-a-time
+   versions, from random starting points. */
+static void
+verify (const struct bitmap *b)
+{
+  size_t size = bitmap_size (b);
+  int i;
+
+  for (i = 0; i < 100; i++)
+    {
+      size_t start = random_ulong () % size;
+      size_t cnt = random_ulong () % (size - start + 1);
+      bool value = random_ulong () % 2;
+      size_t j, value_cnt = 0;
+
+      for (j = start; j < start + cnt; j++)
+        if (bitmap_test (b, j) == value)
+          value_cnt++;
+      ASSERT (bitmap_count (b, start, cnt, value) == value_cnt);
+      ASSERT (bitmap_contains (b, start, cnt, value) == (value_cnt > 0));
+      ASSERT (bitmap_scan (b, start, cnts[i % 4], value)
+              == slow_scan (b, start, cnts[i % 4], value));
+    }
+}
+
+/* Prints how many scans for CNT false bits, from random starting
+   points, B sustains per second. */
+static void
+time_scans (const struct bitmap *b, size_t cnt)
+{
+  int64_t start;
+  int64_t elapsed;
+  int i;
+
+  start = timer_ticks ();
+  for (i = 0; i < SCAN_CNT; i++)
+    bitmap_scan (b, random_ulong () % bitmap_size (b), cnt, false);
+  elapsed = timer_elapsed (start);
+
+  printf ("  scan for %zu bits: %d scans in %lld ticks", cnt, SCAN_CNT,
+          elapsed);
+  if (elapsed > 0)
+    printf (", %lld per second", SCAN_CNT * TIMER_FREQ / elapsed);
+  printf ("\n");
+}
+
+/* Prints how long it takes to fill a bitmap of SIZE bits with
+   bitmap_scan_and_flip(), one bit at a time from bit 0, the way a
+   first-fit allocator would. */
+static void
+time_fill (size_t size)
+{
+  struct bitmap *b = bitmap_create (size);
+  int64_t start;
+  size_t i;
+
+  ASSERT (b != NULL);
+  start = timer_ticks ();
+  for (i = 0; i < size; i++)
+    ASSERT (bitmap_scan_and_flip (b, 0, 1, false) == i);
+  ASSERT (bitmap_scan_and_flip (b, 0, 1, false) == BITMAP_ERROR);
+  printf ("  fill one bit at a time: %lld ticks\n", timer_elapsed (start));
+
+  bitmap_destroy (b);
+}
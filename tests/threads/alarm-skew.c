@@ -0,0 +1,123 @@
+/* Creates many threads that each sleep until a different tick,
+   spread over several revolutions of the timer's wheel, and
+   checks how late each one wakes up relative to the tick it
+   asked for.  With an O(1) sleep queue the wake-up skew should
+   stay at most a tick even with thousands of sleepers. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of sleeping threads. */
+#define SLEEPER_CNT 2000
+
+/* Wake-up ticks are spread over this many ticks. */
+#define SLEEP_SPREAD 600
+
+/* Largest acceptable wake-up skew, in ticks. */
+#define SKEW_MAX 1
+
+/* Information about the test. */
+struct skew_test {
+  struct semaphore go;        /* Released once all threads exist. */
+  struct semaphore done;      /* Upped by each thread on wake-up. */
+  int64_t start;              /* Time at which sleepers were released. */
+  int *skew;                  /* Wake-up skew for each sleeper. */
+};
+
+/* Information about an individual sleeper. */
+struct skew_thread {
+  struct skew_test *test;     /* Info shared between all threads. */
+  int id;                     /* Sleeper ID. */
+};
+
+static void sleeper (void *);
+
+void
+test_alarm_skew (void)
+{
+  struct skew_test test;
+  struct skew_thread *threads;
+  int early_cnt, late_cnt, max_skew;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  msg ("Creating %d threads to sleep until different ticks.", SLEEPER_CNT);
+  msg ("Each thread should wake up within %d tick(s) of its target.",
+       SKEW_MAX);
+
+  /* Allocate memory. */
+  threads = malloc (sizeof *threads * SLEEPER_CNT);
+  test.skew = malloc (sizeof *test.skew * SLEEPER_CNT);
+  if (threads == NULL || test.skew == NULL)
+    PANIC ("couldn't allocate memory for test");
+
+  /* Initialize test. */
+  sema_init (&test.go, 0);
+  sema_init (&test.done, 0);
+
+  /* Start threads.  They wait on GO so that none of them starts
+     sleeping before the last one has been created. */
+  for (i = 0; i < SLEEPER_CNT; i++)
+    {
+      struct skew_thread *t = threads + i;
+      char name[16];
+
+      t->test = &test;
+      t->id = i;
+
+      snprintf (name, sizeof name, "sleeper %d", i);
+      if (thread_create (name, PRI_DEFAULT, sleeper, t) == TID_ERROR)
+        fail ("couldn't create thread %d", i);
+    }
+
+  /* Release the sleepers and wait for all of them to wake up. */
+  test.start = timer_ticks () + 50;
+  for (i = 0; i < SLEEPER_CNT; i++)
+    sema_up (&test.go);
+  for (i = 0; i < SLEEPER_CNT; i++)
+    sema_down (&test.done);
+
+  /* Check the skew of every sleeper. */
+  early_cnt = late_cnt = max_skew = 0;
+  for (i = 0; i < SLEEPER_CNT; i++)
+    {
+      if (test.skew[i] < 0)
+        early_cnt++;
+      else if (test.skew[i] > SKEW_MAX)
+        late_cnt++;
+      if (test.skew[i] > max_skew)
+        max_skew = test.skew[i];
+    }
+  if (early_cnt > 0)
+    fail ("%d threads woke up before their target tick", early_cnt);
+  if (late_cnt > 0)
+    fail ("%d threads woke up late, by up to %d ticks", late_cnt, max_skew);
+  msg ("All %d threads woke up on time.", SLEEPER_CNT);
+
+  free (test.skew);
+  free (threads);
+}
+
+/* Sleeper thread. */
+static void
+sleeper (void *t_)
+{
+  struct skew_thread *t = t_;
+  struct skew_test *test = t->test;
+  int64_t sleep_until;
+
+  sema_down (&test->go);
+
+  sleep_until = test->start + (t->id * 7) % SLEEP_SPREAD;
+  timer_sleep (sleep_until - timer_ticks ());
+  test->skew[t->id] = timer_ticks () - sleep_until;
+
+  sema_up (&test->done);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(alarm-skew) begin
+(alarm-skew) Creating 2000 threads to sleep until different ticks.
+(alarm-skew) Each thread should wake up within 1 tick(s) of its target.
+(alarm-skew) All 2000 threads woke up on time.
+(alarm-skew) end
+EOF
+pass;
@@ -0,0 +1,91 @@
+/* The main thread and a "reader" thread acquire a readers-writer
+   lock for reading.  A higher-priority "writer" thread then blocks
+   trying to write, donating its priority to both readers.  A
+   still higher-priority "late reader" blocks trying to read,
+   because a writer is waiting, and donates to both readers too.
+   Once both readers have released the lock, the writer should get
+   it before the late reader, and each thread's priority should be
+   restored when it releases the lock. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+struct rw_test {
+  struct rwlock rwlock;       /* Lock being tested. */
+  struct semaphore sema;      /* Keeps the reader holding the lock. */
+};
+
+static thread_func reader_thread_func;
+static thread_func writer_thread_func;
+static thread_func late_reader_thread_func;
+
+void
+test_priority_donate_rw (void)
+{
+  struct rw_test test;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&test.rwlock);
+  sema_init (&test.sema, 0);
+  rwlock_acquire_read (&test.rwlock);
+
+  thread_create ("reader", PRI_DEFAULT + 1, reader_thread_func, &test);
+  thread_create ("writer", PRI_DEFAULT + 2, writer_thread_func, &test);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 2, thread_get_priority ());
+  thread_create ("late reader", PRI_DEFAULT + 3, late_reader_thread_func,
+                 &test);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 3, thread_get_priority ());
+
+  rwlock_release_read (&test.rwlock);
+  msg ("This thread should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT, thread_get_priority ());
+
+  sema_up (&test.sema);
+  msg ("Readers and writer must already have finished.");
+}
+
+static void
+reader_thread_func (void *test_)
+{
+  struct rw_test *test = test_;
+
+  rwlock_acquire_read (&test->rwlock);
+  msg ("reader: got the lock for reading");
+  sema_down (&test->sema);
+  msg ("reader: should have priority %d.  Actual priority: %d.",
+       PRI_DEFAULT + 3, thread_get_priority ());
+  rwlock_release_read (&test->rwlock);
+  msg ("reader: done");
+}
+
+static void
+writer_thread_func (void *test_)
+{
+  struct rw_test *test = test_;
+
+  rwlock_acquire_write (&test->rwlock);
+  msg ("writer: got the lock for writing");
+  rwlock_release_write (&test->rwlock);
+  msg ("writer: done");
+}
+
+static void
+late_reader_thread_func (void *test_)
+{
+  struct rw_test *test = test_;
+
+  rwlock_acquire_read (&test->rwlock);
+  msg ("late reader: got the lock for reading");
+  rwlock_release_read (&test->rwlock);
+  msg ("late reader: done");
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(priority-donate-rw) begin
+(priority-donate-rw) reader: got the lock for reading
+(priority-donate-rw) This thread should have priority 33.  Actual priority: 33.
+(priority-donate-rw) This thread should have priority 34.  Actual priority: 34.
+(priority-donate-rw) This thread should have priority 31.  Actual priority: 31.
+(priority-donate-rw) reader: should have priority 34.  Actual priority: 34.
+(priority-donate-rw) writer: got the lock for writing
+(priority-donate-rw) late reader: got the lock for reading
+(priority-donate-rw) late reader: done
+(priority-donate-rw) writer: done
+(priority-donate-rw) reader: done
+(priority-donate-rw) Readers and writer must already have finished.
+(priority-donate-rw) end
+EOF
+pass;
@@ -0,0 +1,60 @@
+/* Measures how fast kernel threads can be created and destroyed.
+   The main thread repeatedly creates a batch of threads that exit
+   as soon as they run, waits for all of them, and reports the
+   number of create/exit pairs completed per second.  Batches are
+   small enough that the pages of exited threads can be recycled
+   by the next batch. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Number of threads created per batch. */
+#define BATCH_SIZE 8
+
+/* Number of batches. */
+#define BATCH_CNT 500
+
+static void exiter (void *);
+
+void
+test_thread_churn (void)
+{
+  struct semaphore done;
+  int64_t start, elapsed;
+  int i, j;
+
+  msg ("Creating %d batches of %d threads that exit immediately.",
+       BATCH_CNT, BATCH_SIZE);
+
+  sema_init (&done, 0);
+  start = timer_ticks ();
+  for (i = 0; i < BATCH_CNT; i++)
+    {
+      for (j = 0; j < BATCH_SIZE; j++)
+        if (thread_create ("exiter", PRI_DEFAULT, exiter, &done) == TID_ERROR)
+          fail ("couldn't create thread %d of batch %d", j, i);
+      for (j = 0; j < BATCH_SIZE; j++)
+        sema_down (&done);
+    }
+  elapsed = timer_elapsed (start);
+
+  msg ("%d threads created and exited in %lld ticks.",
+       BATCH_CNT * BATCH_SIZE, elapsed);
+  if (elapsed > 0)
+    msg ("%lld threads per second.",
+         BATCH_CNT * BATCH_SIZE * TIMER_FREQ / elapsed);
+  pass ();
+}
+
+/* Thread that signals its creator and exits. */
+static void
+exiter (void *done_)
+{
+  struct semaphore *done = done_;
+
+  sema_up (done);
+}
@@ -0,0 +1,49 @@
+/* Forks a child that checks that it sees the parent's memory and
+   then overwrites it, while the parent overwrites its own copy.
+   Each must see only its own writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (128 * 1024)
+
+static char buf[SIZE];
+
+/* Fails unless every byte of buf is C. */
+static void
+check_buf (const char *who, char c)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != c)
+      fail ("%s: byte %zu is %#x, not %#x", who, i, buf[i] & 0xff, c & 0xff);
+}
+
+void
+test_main (void)
+{
+  pid_t child;
+  int status;
+
+  memset (buf, 0x5a, sizeof buf);
+  child = fork ();
+  if (child == 0)
+    {
+      check_buf ("child", 0x5a);
+      memset (buf, 0xa5, sizeof buf);
+      check_buf ("child", 0xa5);
+      exit (81);
+    }
+  if (child == PID_ERROR)
+    fail ("fork failed");
+
+  memset (buf, 0x33, sizeof buf);
+  status = wait (child);
+  if (status != 81)
+    fail ("wait returned %d, not 81", status);
+  check_buf ("parent", 0x33);
+  msg ("parent and child kept separate copies");
+}
@@ -0,0 +1,40 @@
+/* Writes a file from a mapping of that same file, with the middle
+   page of the mapping not yet loaded, so that copying the data
+   into the file faults in a page of the file being written. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+#define PAGE_CNT 3
+
+static char buf[PAGE_CNT * 4096];
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i * 7 + i / 4096;
+
+  CHECK (create ("data", sizeof buf), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+  CHECK (write (handle, buf, sizeof buf) == (int) sizeof buf,
+         "write \"data\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"data\"");
+
+  /* Write the whole mapping back over the file. */
+  seek (handle, 0);
+  CHECK (write (handle, ACTUAL, sizeof buf) == (int) sizeof buf,
+         "write \"data\" from its own mapping");
+  msg ("munmap \"data\"");
+  munmap (map);
+  msg ("close \"data\"");
+  close (handle);
+
+  check_file ("data", buf, sizeof buf);
+}
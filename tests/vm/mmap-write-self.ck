@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-write-self) begin
+(mmap-write-self) create "data"
+(mmap-write-self) open "data"
+(mmap-write-self) write "data"
+(mmap-write-self) mmap "data"
+(mmap-write-self) write "data" from its own mapping
+(mmap-write-self) munmap "data"
+(mmap-write-self) close "data"
+(mmap-write-self) open "data" for verification
+(mmap-write-self) verified contents of "data"
+(mmap-write-self) close "data"
+(mmap-write-self) end
+EOF
+pass;
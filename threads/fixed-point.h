@@ -63,4 +63,20 @@ typedef int32_t fixed_float;
 #define div_real_by_int(REAL, INT)   \
         ((REAL)/(INT))
 
+/* Raise REAL to the nonnegative int power N, by repeated squaring. */
+static inline fixed_float
+pow_real_by_int (fixed_float real, int64_t n)
+{
+  fixed_float result = convert_int_to_real (1);
+
+  while (n > 0)
+    {
+      if (n & 1)
+        result = mul_real_by_real (result, real);
+      real = mul_real_by_real (real, real);
+      n >>= 1;
+    }
+  return result;
+}
+
 #endif
@@ -20,6 +20,7 @@
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
 #ifdef USERPROG
@@ -38,6 +39,11 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -99,6 +105,7 @@ int main (void) NO_RETURN;
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+  profile_init ();
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -120,6 +127,7 @@ int main (void) NO_RETURN;
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  palloc_start_zeroer ();
   serial_init_queue ();
   timer_calibrate ();
 
@@ -130,6 +138,12 @@ int main (void) NO_RETURN;
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  frame_init ();
+  swap_init ();
+#endif
+
   printf ("Boot complete.\n");
 
   /* Run actions specified on kernel command line. */
@@ -259,9 +273,17 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-profile"))
+        profile_configure (value != NULL ? atoi (value) : 0);
 #ifdef USERPROG
         else if (!strcmp (name, "-ul"))
           user_page_limit = atoi (value);
+#endif
+#ifdef VM
+        else if (!strcmp (name, "-sl"))
+          page_set_stack_limit (atoi (value));
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -381,8 +403,15 @@ usage (void)
 #endif
             "  -rs=SEED           Set random number seed to SEED.\n"
             "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+            "  -tickless          Stop the timer tick while the CPU is idle.\n"
+            "  -profile[=DEPTH]   Sample the running code on each timer tick,\n"
+            "                     with up to DEPTH callers, and print the\n"
+            "                     samples at shutdown.\n"
 #ifdef USERPROG
     "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+    "  -sl=COUNT          Limit user stacks to COUNT pages (default 2048).\n"
 #endif
   );
   shutdown_power_off ();
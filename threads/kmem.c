@@ -0,0 +1,269 @@
+#include "threads/kmem.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Object caches.
+
+   Each cache hands out objects of a single size, carved out of
+   page-sized "slabs" obtained from the page allocator.  Unlike
+   malloc(), which rounds every request up to a power of 2, a
+   cache packs objects at their own size, so that for example a
+   540-byte struct inode takes 540 bytes instead of 1 kB.
+
+   A slab starts with a header that threads its free objects
+   together through an array of object indexes, so that the free
+   list never overwrites a free object.  Objects therefore keep
+   the state the constructor gave them while they are free, and
+   the constructor only runs when a slab is created.
+
+   Freed objects first go into the cache's magazine, a small
+   stack from which the next allocations are served without
+   touching any slab.  Only when the magazine is full is an
+   object returned to its slab, and a slab whose objects are all
+   free is given back to the page allocator.
+
+   All of this is quick, so caches are protected by disabling
+   interrupts, and objects may be freed from any context. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Marks the end of a slab's free list. */
+#define SLAB_NONE UINT16_MAX
+
+/* Object alignment. */
+#define KMEM_ALIGN sizeof (void *)
+
+/* Slab header, at the start of the slab's page. */
+struct slab {
+  unsigned magic;                 /* Always set to SLAB_MAGIC. */
+  struct kmem_cache *cache;       /* Owning cache. */
+  struct list_elem elem;          /* Element in cache's partial_slabs. */
+  size_t free_cnt;                /* # of free objects. */
+  uint16_t free_idx;              /* First free object, or SLAB_NONE. */
+  uint16_t next[];                /* Free object after each free object. */
+};
+
+/* List of all caches, for statistics. */
+static struct list all_caches = LIST_INITIALIZER (all_caches);
+
+static struct slab *slab_create (struct kmem_cache *);
+static void *slab_to_obj (struct kmem_cache *, struct slab *, size_t idx);
+static size_t obj_to_idx (struct kmem_cache *, struct slab *, void *obj);
+
+/* Initializes CACHE to hand out objects of SIZE bytes, named NAME
+   in statistics.  If CTOR is nonnull, it is called on each
+   object when the object's slab is created. */
+void
+kmem_cache_init (struct kmem_cache *cache, const char *name, size_t size,
+                 kmem_ctor_func *ctor)
+{
+  enum intr_level old_level;
+  size_t n;
+
+  ASSERT (cache != NULL);
+  ASSERT (size > 0);
+
+  cache->name = name;
+  cache->obj_size = ROUND_UP (size, KMEM_ALIGN);
+  cache->ctor = ctor;
+  list_init (&cache->partial_slabs);
+  cache->magazine_cnt = 0;
+  cache->slab_cnt = 0;
+  cache->in_use = 0;
+  cache->alloc_cnt = 0;
+  cache->magazine_hits = 0;
+
+  /* Fit as many objects as possible in a page along with the
+     header and its free list array. */
+  for (n = (PGSIZE - sizeof (struct slab)) / (cache->obj_size
+                                              + sizeof (uint16_t));
+       n > 0; n--)
+    {
+      size_t ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                             KMEM_ALIGN);
+      if (ofs + n * cache->obj_size <= PGSIZE)
+        {
+          cache->obj_ofs = ofs;
+          break;
+        }
+    }
+  if (n == 0)
+    PANIC ("%s objects of %zu bytes do not fit in a slab", name, size);
+  cache->objs_per_slab = n < SLAB_NONE ? n : SLAB_NONE - 1;
+
+  old_level = intr_disable ();
+  list_push_back (&all_caches, &cache->elem);
+  intr_set_level (old_level);
+}
+
+/* Allocates and returns an object from CACHE, or a null pointer
+   if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *cache)
+{
+  enum intr_level old_level;
+  struct slab *slab;
+  void *obj;
+
+  old_level = intr_disable ();
+  cache->alloc_cnt++;
+  if (cache->magazine_cnt > 0)
+    {
+      obj = cache->magazine[--cache->magazine_cnt];
+      cache->magazine_hits++;
+      cache->in_use++;
+      intr_set_level (old_level);
+      return obj;
+    }
+
+  if (list_empty (&cache->partial_slabs))
+    {
+      slab = slab_create (cache);
+      if (slab == NULL)
+        {
+          intr_set_level (old_level);
+          return NULL;
+        }
+      list_push_front (&cache->partial_slabs, &slab->elem);
+    }
+  else
+    slab = list_entry (list_front (&cache->partial_slabs),
+                       struct slab, elem);
+
+  ASSERT (slab->free_cnt > 0);
+  obj = slab_to_obj (cache, slab, slab->free_idx);
+  slab->free_idx = slab->next[slab->free_idx];
+  if (--slab->free_cnt == 0)
+    list_remove (&slab->elem);
+  cache->in_use++;
+  intr_set_level (old_level);
+
+  return obj;
+}
+
+/* Returns OBJ, which must have been allocated from CACHE, to
+   CACHE.  If CACHE has a constructor, OBJ must be in its
+   constructed state. */
+void
+kmem_cache_free (struct kmem_cache *cache, void *obj)
+{
+  enum intr_level old_level;
+  struct slab *slab;
+  size_t idx;
+
+  if (obj == NULL)
+    return;
+
+  slab = pg_round_down (obj);
+  ASSERT (slab->magic == SLAB_MAGIC);
+  ASSERT (slab->cache == cache);
+  idx = obj_to_idx (cache, slab, obj);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs, unless
+     it has to keep its constructed state. */
+  if (cache->ctor == NULL)
+    memset (obj, 0xcc, cache->obj_size);
+#endif
+
+  old_level = intr_disable ();
+  ASSERT (cache->in_use > 0);
+  cache->in_use--;
+  if (cache->magazine_cnt < KMEM_MAGAZINE_SIZE)
+    {
+      cache->magazine[cache->magazine_cnt++] = obj;
+      intr_set_level (old_level);
+      return;
+    }
+
+  /* Return the object to its slab. */
+  slab->next[idx] = slab->free_idx;
+  slab->free_idx = idx;
+  if (slab->free_cnt++ == 0)
+    list_push_front (&cache->partial_slabs, &slab->elem);
+
+  /* Give back the slab if it is now unused. */
+  if (slab->free_cnt == cache->objs_per_slab)
+    {
+      list_remove (&slab->elem);
+      slab->magic = 0;
+      palloc_free_page (slab);
+      cache->slab_cnt--;
+    }
+  intr_set_level (old_level);
+}
+
+/* Prints statistics for each cache. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+
+      printf ("Kmem %s: %zu of %zu objects of %zu bytes in use "
+              "in %zu slabs, %lld allocs (%lld from magazine)\n",
+              c->name, c->in_use, c->slab_cnt * c->objs_per_slab,
+              c->obj_size, c->slab_cnt, c->alloc_cnt, c->magazine_hits);
+    }
+}
+
+/* Allocates a new slab for CACHE, with all of its objects free and
+   constructed.  Returns a null pointer if memory is not
+   available.  Interrupts must be off. */
+static struct slab *
+slab_create (struct kmem_cache *cache)
+{
+  struct slab *slab;
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  slab = palloc_get_page (0);
+  if (slab == NULL)
+    return NULL;
+
+  slab->magic = SLAB_MAGIC;
+  slab->cache = cache;
+  slab->free_cnt = cache->objs_per_slab;
+  slab->free_idx = 0;
+  for (i = 0; i < cache->objs_per_slab; i++)
+    {
+      slab->next[i] = i + 1 < cache->objs_per_slab ? i + 1 : SLAB_NONE;
+      if (cache->ctor != NULL)
+        cache->ctor (slab_to_obj (cache, slab, i));
+    }
+  cache->slab_cnt++;
+
+  return slab;
+}
+
+/* Returns object IDX in SLAB of CACHE. */
+static void *
+slab_to_obj (struct kmem_cache *cache, struct slab *slab, size_t idx)
+{
+  ASSERT (idx < cache->objs_per_slab);
+  return (uint8_t *) slab + cache->obj_ofs + idx * cache->obj_size;
+}
+
+/* Returns the index of OBJ in SLAB of CACHE. */
+static size_t
+obj_to_idx (struct kmem_cache *cache, struct slab *slab, void *obj)
+{
+  size_t ofs = (uint8_t *) obj - (uint8_t *) slab;
+
+  ASSERT (ofs >= cache->obj_ofs);
+  ASSERT ((ofs - cache->obj_ofs) % cache->obj_size == 0);
+  ASSERT ((ofs - cache->obj_ofs) / cache->obj_size < cache->objs_per_slab);
+  return (ofs - cache->obj_ofs) / cache->obj_size;
+}
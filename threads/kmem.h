@@ -0,0 +1,43 @@
+#ifndef THREADS_KMEM_H
+#define THREADS_KMEM_H
+
+#include <list.h>
+#include <stddef.h>
+
+/* Number of recently freed objects a cache keeps at hand. */
+#define KMEM_MAGAZINE_SIZE 8
+
+/* Initializes a newly allocated object.  Called once per object
+   when its slab is created, not on every allocation, so objects
+   must be returned to the cache in their constructed state. */
+typedef void kmem_ctor_func (void *obj);
+
+/* Cache of objects of a single type. */
+struct kmem_cache {
+  const char *name;               /* Name, for statistics. */
+  size_t obj_size;                /* Object size, rounded up. */
+  size_t objs_per_slab;           /* Number of objects in a slab. */
+  size_t obj_ofs;                 /* Offset of first object in a slab. */
+  kmem_ctor_func *ctor;           /* Constructor, or a null pointer. */
+  struct list partial_slabs;      /* Slabs with free objects. */
+
+  /* Recently freed objects, reused first. */
+  void *magazine[KMEM_MAGAZINE_SIZE];
+  size_t magazine_cnt;
+
+  /* Statistics. */
+  size_t slab_cnt;                /* # of slabs. */
+  size_t in_use;                  /* # of objects handed out. */
+  long long alloc_cnt;            /* # of allocations. */
+  long long magazine_hits;        /* # served from the magazine. */
+
+  struct list_elem elem;          /* Element in list of all caches. */
+};
+
+void kmem_cache_init (struct kmem_cache *, const char *name, size_t size,
+                      kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_print_stats (void);
+
+#endif /* threads/kmem.h */
@@ -40,6 +40,7 @@ struct desc {
   size_t blocks_per_arena;    /* Number of blocks in an arena. */
   struct list free_list;      /* List of free blocks. */
   struct lock lock;           /* Lock. */
+  char name[16];              /* Lock name, for contention reports. */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -78,6 +79,8 @@ malloc_init (void)
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
       lock_init (&d->lock);
+      snprintf (d->name, sizeof d->name, "malloc %zu", block_size);
+      lock_set_name (&d->lock, d->name);
     }
 }
 
@@ -2,13 +2,16 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/loader.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,21 +26,83 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is managed as a binary buddy system.  Free memory is
+   kept as blocks of 2**ORDER pages, each aligned to its size
+   relative to the base of the pool, on one free list per order.
+   A request is served from the smallest block large enough,
+   splitting it in halves as needed, and pages beyond the request
+   are given back at once.  A freed block is merged with its
+   buddy, the other half of the block it was split from, for as
+   long as the buddy is free too.  Both take O(log n) steps, so
+   the pools are protected by disabling interrupts, which also
+   lets pages be freed while switching threads.
+
+   Zeroing a page takes far longer than allocating it, so a
+   low-priority "zeroer" thread keeps a stock of up to ZERO_HIGH
+   already zeroed pages in each pool, taken from the pool while it
+   has more than ZERO_RESERVE pages free.  Single-page PAL_ZERO
+   requests are served from the stock when possible, and wake the
+   zeroer once it falls below ZERO_LOW.  A request that cannot be
+   satisfied otherwise gives the stock back to the pool first. */
+
+/* Number of block orders.  The largest block is 2**(ORDER_CNT - 1)
+   pages. */
+#define ORDER_CNT 20
+
+/* Pre-zeroed page watermarks, in pages per pool. */
+#define ZERO_LOW 8                  /* Wake the zeroer below this. */
+#define ZERO_HIGH 32                /* Zeroer stops at this. */
+#define ZERO_RESERVE 64             /* Free pages the zeroer leaves. */
+
+/* A free block.  Stored in the block's first page. */
+struct free_block {
+  struct list_elem elem;              /* Element in free list. */
+};
 
 /* A memory pool. */
 struct pool {
-  struct lock lock;                   /* Mutual exclusion. */
   struct bitmap *used_map;            /* Bitmap of free pages. */
   uint8_t *base;                      /* Base of pool. */
+  const char *name;                   /* Name, for statistics. */
+
+  /* Buddy system. */
+  uint8_t *free_order;                /* 1 + order of the free block
+                                         starting at each page, or 0. */
+  struct list free_lists[ORDER_CNT];  /* Free blocks by order. */
+  size_t free_cnt[ORDER_CNT];         /* # of blocks in each list. */
+  size_t free_pages;                  /* # of pages in free blocks. */
+
+  /* Pre-zeroed pages.  These are allocated as far as the buddy
+     system and used_map are concerned.  Each is linked into the
+     list through a free_block at its start, which is cleared when
+     the page is handed out. */
+  struct list zeroed_pages;           /* Zeroed pages. */
+  size_t zeroed_cnt;                  /* # of pages in zeroed_pages. */
+  long long zeroed_hits;              /* PAL_ZERO pages from the stock. */
+  long long zeroed_misses;            /* PAL_ZERO pages zeroed inline. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Zeroer thread. */
+static struct semaphore zeroer_sema;    /* Upped to wake the zeroer. */
+static bool zeroer_sleeping;            /* Zeroer waiting on zeroer_sema? */
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void push_block (struct pool *, size_t page_idx, int order);
+static void remove_block (struct pool *, size_t page_idx, int order);
+static void print_pool_stats (const struct pool *);
+static void *take_zeroed_page (struct pool *);
+static void release_zeroed_pages (struct pool *);
+static bool zero_page (struct pool *);
+static thread_func zeroer;
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -58,6 +123,15 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+  sema_init (&zeroer_sema, 0);
+}
+
+/* Starts the thread that zeroes pages in the background.  Must be
+   called after thread_start(). */
+void
+palloc_start_zeroer (void)
+{
+  thread_create ("zeroer", PRI_MIN, zeroer, NULL);
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -70,24 +144,58 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-  void *pages;
+  void *pages = NULL;
+  bool zeroed = false, wake_zeroer = false;
   size_t page_idx;
+  enum intr_level old_level;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  old_level = intr_disable ();
+  if (flags & PAL_ZERO && page_cnt == 1)
+    {
+      if (pool->zeroed_cnt > 0)
+        {
+          pages = take_zeroed_page (pool);
+          zeroed = true;
+        }
+      if (pool->zeroed_cnt < ZERO_LOW && zeroer_sleeping)
+        {
+          zeroer_sleeping = false;
+          wake_zeroer = true;
+        }
+    }
+  if (pages == NULL)
+    {
+      page_idx = buddy_alloc (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0)
+        {
+          release_zeroed_pages (pool);
+          page_idx = buddy_alloc (pool, page_cnt);
+        }
+      if (page_idx != BITMAP_ERROR)
+        {
+          ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+          bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+          pages = pool->base + PGSIZE * page_idx;
+        }
+    }
+  if (pages != NULL && flags & PAL_ZERO)
+    {
+      if (zeroed)
+        pool->zeroed_hits++;
+      else
+        pool->zeroed_misses += page_cnt;
+    }
+  intr_set_level (old_level);
 
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  if (wake_zeroer)
+    sema_up (&zeroer_sema);
 
   if (pages != NULL)
     {
-      if (flags & PAL_ZERO)
+      if (flags & PAL_ZERO && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else
@@ -118,6 +226,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -136,8 +245,11 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  buddy_free (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -147,15 +259,26 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Prints fragmentation statistics for both pools. */
+void
+palloc_print_stats (void)
+{
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map and free_order at its base.
+     Calculate the space needed for them and subtract it from the
+     pool's size. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -163,9 +286,24 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
   p->base = base + bm_pages * PGSIZE;
+  p->name = name;
+
+  /* Put all of the pool's pages on the free lists. */
+  p->free_order = (uint8_t *) base + bm_size;
+  memset (p->free_order, 0, page_cnt);
+  for (order = 0; order < ORDER_CNT; order++)
+    {
+      list_init (&p->free_lists[order]);
+      p->free_cnt[order] = 0;
+    }
+  p->free_pages = 0;
+  buddy_free (p, 0, page_cnt);
+
+  list_init (&p->zeroed_pages);
+  p->zeroed_cnt = 0;
+  p->zeroed_hits = p->zeroed_misses = 0;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -179,3 +317,228 @@ page_from_pool (const struct pool *pool, void *page)
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Adds the block of 2**ORDER pages at PAGE_IDX in POOL to the
+   free list for ORDER. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order)
+{
+  struct free_block *b = (struct free_block *) (pool->base
+                                                + PGSIZE * page_idx);
+
+  pool->free_order[page_idx] = order + 1;
+  list_push_front (&pool->free_lists[order], &b->elem);
+  pool->free_cnt[order]++;
+  pool->free_pages += (size_t) 1 << order;
+}
+
+/* Removes the block of 2**ORDER pages at PAGE_IDX in POOL from the
+   free list for ORDER. */
+static void
+remove_block (struct pool *pool, size_t page_idx, int order)
+{
+  struct free_block *b = (struct free_block *) (pool->base
+                                                + PGSIZE * page_idx);
+
+  ASSERT (pool->free_order[page_idx] == order + 1);
+  pool->free_order[page_idx] = 0;
+  list_remove (&b->elem);
+  pool->free_cnt[order]--;
+  pool->free_pages -= (size_t) 1 << order;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first one, or BITMAP_ERROR if no free block is
+   large enough.  Interrupts must be off. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  struct free_block *b;
+  size_t page_idx;
+  int order, want;
+
+  /* Find the smallest order that covers PAGE_CNT, then the
+     smallest non-empty free list at or above it. */
+  for (want = 0; want < ORDER_CNT && (size_t) 1 << want < page_cnt; want++)
+    continue;
+  for (order = want; order < ORDER_CNT; order++)
+    if (!list_empty (&pool->free_lists[order]))
+      break;
+  if (order >= ORDER_CNT)
+    return BITMAP_ERROR;
+
+  b = list_entry (list_front (&pool->free_lists[order]),
+                  struct free_block, elem);
+  page_idx = ((uint8_t *) b - pool->base) / PGSIZE;
+  remove_block (pool, page_idx, order);
+
+  /* Split off upper halves until the block is just big enough. */
+  while (order > want)
+    {
+      order--;
+      push_block (pool, page_idx + ((size_t) 1 << order), order);
+    }
+
+  /* Give back the pages past the end of the request. */
+  if (page_cnt < (size_t) 1 << order)
+    buddy_free (pool, page_idx + page_cnt,
+                ((size_t) 1 << order) - page_cnt);
+
+  return page_idx;
+}
+
+/* Returns the PAGE_CNT pages starting at PAGE_IDX to POOL's free
+   lists, merging them with free buddies.  The range is split into
+   the largest blocks that are aligned to their own size.
+   Interrupts must be off. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t pool_size = bitmap_size (pool->used_map);
+
+  while (page_cnt > 0)
+    {
+      size_t block_idx = page_idx;
+      size_t block_cnt;
+      int order;
+
+      for (order = 0; order + 1 < ORDER_CNT; order++)
+        {
+          size_t next_cnt = (size_t) 1 << (order + 1);
+          if (page_idx % next_cnt != 0 || next_cnt > page_cnt)
+            break;
+        }
+      block_cnt = (size_t) 1 << order;
+      page_idx += block_cnt;
+      page_cnt -= block_cnt;
+
+      /* Merge with the buddy while it is a free block of the same
+         order. */
+      for (; order + 1 < ORDER_CNT; order++)
+        {
+          size_t buddy_idx = block_idx ^ ((size_t) 1 << order);
+          if (buddy_idx + ((size_t) 1 << order) > pool_size
+              || pool->free_order[buddy_idx] != order + 1)
+            break;
+          remove_block (pool, buddy_idx, order);
+          if (buddy_idx < block_idx)
+            block_idx = buddy_idx;
+        }
+      push_block (pool, block_idx, order);
+    }
+}
+
+/* Prints the free pages in POOL, how they are broken up into
+   blocks, and the size of the largest block, which bounds the
+   largest request that can succeed. */
+static void
+print_pool_stats (const struct pool *pool)
+{
+  size_t free_pages = 0, block_cnt = 0, largest = 0;
+  int order;
+
+  for (order = 0; order < ORDER_CNT; order++)
+    if (pool->free_cnt[order] > 0)
+      {
+        free_pages += pool->free_cnt[order] << order;
+        block_cnt += pool->free_cnt[order];
+        largest = (size_t) 1 << order;
+      }
+
+  printf ("Palloc: %s: %zu of %zu pages free in %zu blocks, "
+          "largest %zu pages\n",
+          pool->name, free_pages, bitmap_size (pool->used_map),
+          block_cnt, largest);
+  printf ("Palloc: %s: %lld zeroed pages from stock, %lld zeroed inline\n",
+          pool->name, pool->zeroed_hits, pool->zeroed_misses);
+}
+
+/* Removes a page from POOL's stock of zeroed pages and returns
+   it.  Interrupts must be off. */
+static void *
+take_zeroed_page (struct pool *pool)
+{
+  struct free_block *b;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  b = list_entry (list_pop_front (&pool->zeroed_pages),
+                  struct free_block, elem);
+  pool->zeroed_cnt--;
+  memset (b, 0, sizeof *b);
+  return b;
+}
+
+/* Returns all of POOL's zeroed pages to its free lists.
+   Interrupts must be off. */
+static void
+release_zeroed_pages (struct pool *pool)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (pool->zeroed_cnt > 0)
+    {
+      uint8_t *page = take_zeroed_page (pool);
+      size_t page_idx = (page - pool->base) / PGSIZE;
+
+      bitmap_reset (pool->used_map, page_idx);
+      buddy_free (pool, page_idx, 1);
+    }
+}
+
+/* Adds one zeroed page to POOL's stock, if it is short of pages
+   and the pool has enough free memory to spare one.  Returns
+   true if a page was added. */
+static bool
+zero_page (struct pool *pool)
+{
+  struct free_block *b;
+  enum intr_level old_level;
+  size_t page_idx;
+
+  old_level = intr_disable ();
+  if (pool->zeroed_cnt >= ZERO_HIGH || pool->free_pages <= ZERO_RESERVE)
+    page_idx = BITMAP_ERROR;
+  else
+    page_idx = buddy_alloc (pool, 1);
+  if (page_idx != BITMAP_ERROR)
+    bitmap_mark (pool->used_map, page_idx);
+  intr_set_level (old_level);
+
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  /* Zero the page with interrupts on; this is the slow part. */
+  b = (struct free_block *) (pool->base + PGSIZE * page_idx);
+  memset (b, 0, PGSIZE);
+
+  old_level = intr_disable ();
+  list_push_back (&pool->zeroed_pages, &b->elem);
+  pool->zeroed_cnt++;
+  intr_set_level (old_level);
+
+  return true;
+}
+
+/* Zeroer thread.  Tops up the stock of zeroed pages in both pools,
+   then sleeps until a PAL_ZERO request finds a stock running low. */
+static void
+zeroer (void *aux UNUSED)
+{
+  if (thread_mlfqs)
+    thread_set_nice (20);
+
+  for (;;)
+    {
+      bool kernel_added = zero_page (&kernel_pool);
+      bool user_added = zero_page (&user_pool);
+
+      if (!kernel_added && !user_added)
+        {
+          enum intr_level old_level = intr_disable ();
+          zeroer_sleeping = true;
+          sema_down (&zeroer_sema);
+          intr_set_level (old_level);
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Sampling profiler.
+
+   When enabled with the "-profile" kernel command-line option,
+   every timer interrupt records the address at which the
+   interrupted code was running into a buffer allocated at boot.
+   If a depth was given, as in "-profile=4", up to that many
+   return addresses of the interrupted kernel code are recorded
+   too, found by following the saved frame pointers.  User code
+   contributes its address only, since its stack may not be
+   safe to read from an interrupt handler.
+
+   At shutdown the samples are printed one per line, and
+   utils/backtrace's --profile option turns them into a flat
+   profile and a call graph. */
+
+/* Number of pages in the sample buffer. */
+#define PROFILE_PAGES 16
+
+static bool profile_enabled;    /* Sample on timer interrupts? */
+static int profile_depth;       /* Return addresses per sample. */
+
+/* Sample buffer.  Each sample takes 1 + PROFILE_DEPTH words: the
+   interrupted address, followed by return addresses innermost
+   first, padded with nulls. */
+static uint32_t *samples;
+static size_t sample_words;     /* Capacity of SAMPLES, in words. */
+static size_t sample_cnt;       /* # of samples recorded. */
+static long long dropped_cnt;   /* # of samples lost to a full buffer. */
+
+/* Enables the profiler, recording DEPTH return addresses with
+   each sample.  Must be called before profile_init(). */
+void
+profile_configure (int depth)
+{
+  profile_enabled = true;
+  if (depth < 0)
+    depth = 0;
+  else if (depth > PROFILE_DEPTH_MAX)
+    depth = PROFILE_DEPTH_MAX;
+  profile_depth = depth;
+}
+
+/* Allocates the sample buffer, if the profiler is enabled. */
+void
+profile_init (void)
+{
+  if (!profile_enabled)
+    return;
+
+  samples = palloc_get_multiple (PAL_ASSERT, PROFILE_PAGES);
+  sample_words = PROFILE_PAGES * PGSIZE / sizeof *samples;
+}
+
+/* Records a sample of the code interrupted with frame F.  Called
+   by the timer interrupt handler. */
+void
+profile_sample (const struct intr_frame *f)
+{
+  uint32_t *s;
+  int i;
+
+  if (samples == NULL)
+    return;
+
+  ASSERT (intr_context ());
+
+  if ((sample_cnt + 1) * (1 + profile_depth) > sample_words)
+    {
+      dropped_cnt++;
+      return;
+    }
+  s = samples + sample_cnt++ * (1 + profile_depth);
+  *s++ = (uint32_t) f->eip;
+
+  /* The interrupted kernel code's frames are on the same kernel
+     stack as F, so stay within its page while following them. */
+  if (f->cs == SEL_KCSEG)
+    {
+      uintptr_t bottom = (uintptr_t) f;
+      uintptr_t top = (uintptr_t) pg_round_down (f) + PGSIZE;
+      uint32_t *frame = (uint32_t *) f->ebp;
+
+      for (i = 0; i < profile_depth; i++)
+        {
+          if ((uintptr_t) frame < bottom
+              || (uintptr_t) (frame + 2) > top
+              || frame[1] == 0)
+            break;
+          *s++ = frame[1];
+          frame = (uint32_t *) frame[0];
+        }
+    }
+  else
+    i = 0;
+
+  for (; i < profile_depth; i++)
+    *s++ = 0;
+}
+
+/* Prints the recorded samples, one per line. */
+void
+profile_print_samples (void)
+{
+  size_t i;
+  int j;
+
+  if (samples == NULL)
+    return;
+
+  printf ("Profile: %zu samples of depth %d, %lld dropped\n",
+          sample_cnt, profile_depth, dropped_cnt);
+  for (i = 0; i < sample_cnt; i++)
+    {
+      const uint32_t *s = samples + i * (1 + profile_depth);
+
+      printf ("Profile sample: %#"PRIx32, s[0]);
+      for (j = 1; j <= profile_depth && s[j] != 0; j++)
+        printf (" %#"PRIx32, s[j]);
+      printf ("\n");
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+
+struct intr_frame;
+
+/* Most return addresses recorded per sample. */
+#define PROFILE_DEPTH_MAX 8
+
+void profile_configure (int depth);
+void profile_init (void);
+void profile_sample (const struct intr_frame *);
+void profile_print_samples (void);
+
+#endif /* threads/profile.h */
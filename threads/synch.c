@@ -29,6 +29,7 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
@@ -38,6 +39,31 @@ struct semaphore_elem {
   struct semaphore semaphore;         /* This semaphore. */
 };
 
+/* Contention statistics of a named lock.  Times are in timer
+   ticks. */
+struct lock_profile {
+  const char *name;           /* Lock name. */
+  long long acquire_cnt;      /* # of acquisitions. */
+  long long contended_cnt;    /* # of acquisitions that had to wait. */
+  int64_t wait_ticks;         /* Total time spent waiting to acquire. */
+  int64_t max_wait_ticks;     /* Longest wait to acquire. */
+  int64_t hold_ticks;         /* Total time the lock was held. */
+  int64_t max_hold_ticks;     /* Longest time the lock was held. */
+  int64_t acquire_time;       /* Time of the current acquisition. */
+};
+
+/* Profiles of all named locks.  Named locks are meant to be
+   long-lived, so profiles are never freed. */
+#define LOCK_PROFILE_CNT 32
+static struct lock_profile lock_profiles[LOCK_PROFILE_CNT];
+static size_t lock_profile_cnt;
+
+/* Number of locks listed by lock_print_stats(). */
+#define LOCK_REPORT_CNT 10
+
+static void lock_profile_acquired (struct lock_profile *, bool contended,
+                                   int64_t start);
+
 static void lock_acquire_vanilla (struct lock *);
 static void lock_acquire_priority (struct lock *);
 static void lock_release_vanilla (struct lock *);
@@ -192,9 +218,50 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   lock->priority = -1;
+  lock->profile = NULL;
   sema_init (&lock->semaphore, 1);
 }
 
+/* Names LOCK NAME and starts collecting contention statistics for
+   it, to be reported by lock_print_stats().  NAME must remain valid,
+   and LOCK must not be freed, until the kernel shuts down.  Once
+   LOCK_PROFILE_CNT locks are named, further locks are not
+   profiled. */
+void
+lock_set_name (struct lock *lock, const char *name)
+{
+  enum intr_level old_level;
+
+  ASSERT (lock != NULL);
+  ASSERT (name != NULL);
+
+  old_level = intr_disable ();
+  if (lock->profile == NULL && lock_profile_cnt < LOCK_PROFILE_CNT)
+    lock->profile = &lock_profiles[lock_profile_cnt++];
+  if (lock->profile != NULL)
+    lock->profile->name = name;
+  intr_set_level (old_level);
+}
+
+/* Records in PROFILE an acquisition of its lock that started at
+   time START, and had to wait if CONTENDED is true. */
+static void
+lock_profile_acquired (struct lock_profile *profile, bool contended,
+                       int64_t start)
+{
+  int64_t now = timer_ticks ();
+
+  profile->acquire_cnt++;
+  if (contended)
+    {
+      profile->contended_cnt++;
+      profile->wait_ticks += now - start;
+      if (now - start > profile->max_wait_ticks)
+        profile->max_wait_ticks = now - start;
+    }
+  profile->acquire_time = now;
+}
+
 /* Original implementation of LOCK acquire, this is used by mlfq scheduler
 as it doesn't need to acquire lock with priority inversion fixing by
 donation. */
@@ -246,14 +313,24 @@ lock_acquire_priority (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  bool contended;
+  int64_t start = 0;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  contended = lock->semaphore.value == 0;
+  if (lock->profile != NULL)
+    start = timer_ticks ();
+
   if (thread_mlfqs)
     lock_acquire_vanilla (lock);
   else
     lock_acquire_priority (lock);
+
+  if (lock->profile != NULL)
+    lock_profile_acquired (lock->profile, contended, start);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -272,7 +349,11 @@ lock_try_acquire (struct lock *lock)
 
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      if (lock->profile != NULL)
+        lock_profile_acquired (lock->profile, false, 0);
+    }
   return success;
 }
 
@@ -329,6 +410,16 @@ lock_release (struct lock *lock)
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  if (lock->profile != NULL)
+    {
+      struct lock_profile *profile = lock->profile;
+      int64_t held = timer_ticks () - profile->acquire_time;
+
+      profile->hold_ticks += held;
+      if (held > profile->max_hold_ticks)
+        profile->max_hold_ticks = held;
+    }
+
   if (thread_mlfqs)
     lock_release_vanilla (lock);
   else
@@ -346,6 +437,289 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
+static void rwlock_wait (struct rwlock *, struct list *waiters);
+static void rwlock_acquired (struct rwlock *);
+static void rwlock_release (struct rwlock *);
+static void rwlock_update_priority (struct rwlock *);
+
+/* Initializes RW as a readers-writer lock.  Any number of threads
+   may hold a readers-writer lock for reading at once, or a single
+   thread may hold it for writing.
+
+   Writers are preferred: once a thread is waiting to write, new
+   readers wait until it has acquired and released the lock, so
+   that a stream of readers cannot starve writers.
+
+   Under the priority scheduler, a thread waiting for RW donates
+   its priority to every thread holding RW, the same way it would
+   to the holder of a lock. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  rw->readers = 0;
+  rw->writer = NULL;
+  rw->waiting_writers = 0;
+  list_init (&rw->holders);
+  list_init (&rw->read_waiters);
+  list_init (&rw->write_waiters);
+  rw->priority = -1;
+}
+
+/* Acquires RW for reading, sleeping until no thread holds it or is
+   waiting to hold it for writing.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  while (rw->writer != NULL || rw->waiting_writers > 0)
+    rwlock_wait (rw, &rw->read_waiters);
+  rw->readers++;
+  rwlock_acquired (rw);
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for reading. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->readers > 0);
+  ASSERT (rwlock_held_by_current_thread (rw));
+
+  old_level = intr_disable ();
+  rw->readers--;
+  rwlock_release (rw);
+  intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds it.
+   The current thread must not already hold RW.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_by_current_thread (rw));
+
+  old_level = intr_disable ();
+  rw->waiting_writers++;
+  while (rw->writer != NULL || rw->readers > 0)
+    rwlock_wait (rw, &rw->write_waiters);
+  rw->waiting_writers--;
+  rw->writer = thread_current ();
+  rwlock_acquired (rw);
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for writing. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->writer == thread_current ());
+
+  old_level = intr_disable ();
+  rw->writer = NULL;
+  rwlock_release (rw);
+  intr_set_level (old_level);
+}
+
+/* Returns true if the current thread holds RW, for reading or for
+   writing, false otherwise. */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rw)
+{
+  struct thread *cur = thread_current ();
+  int i;
+
+  ASSERT (rw != NULL);
+
+  for (i = 0; i < RWLOCK_HOLD_CNT; i++)
+    if (cur->rwlock_holds[i].rwlock == rw)
+      return true;
+  return false;
+}
+
+/* Raises RW's priority to PRIORITY and donates PRIORITY to every
+   thread holding RW whose priority is lower.  Called by donate()
+   when a thread in a donation chain waits for RW.  Interrupts must
+   be off. */
+void
+rwlock_donate (struct rwlock *rw, int priority)
+{
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (rw->priority < priority)
+    rw->priority = priority;
+
+  for (e = list_begin (&rw->holders); e != list_end (&rw->holders);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct rwlock_hold, elem)->thread;
+      if (t->priority < priority)
+        donate (t, priority);
+    }
+}
+
+/* Blocks the current thread on WAITERS, one of RW's wait lists,
+   donating its priority to RW's holders first.  Interrupts must be
+   off. */
+static void
+rwlock_wait (struct rwlock *rw, struct list *waiters)
+{
+  struct thread *cur = thread_current ();
+
+  if (!thread_mlfqs)
+    {
+      cur->rwlock_waiting = rw;
+      rwlock_donate (rw, cur->priority);
+    }
+
+  list_insert_ordered (waiters, &cur->elem, greater_priority, NULL);
+  thread_block ();
+  cur->rwlock_waiting = NULL;
+}
+
+/* Records that the current thread now holds RW.  Threads still
+   waiting for RW donate their priority to it from now on.
+   Interrupts must be off. */
+static void
+rwlock_acquired (struct rwlock *rw)
+{
+  struct thread *cur = thread_current ();
+  struct rwlock_hold *hold = NULL;
+  int i;
+
+  for (i = 0; i < RWLOCK_HOLD_CNT; i++)
+    if (cur->rwlock_holds[i].rwlock == NULL)
+      {
+        hold = &cur->rwlock_holds[i];
+        break;
+      }
+  if (hold == NULL)
+    PANIC ("thread %s holds too many readers-writer locks", cur->name);
+
+  hold->rwlock = rw;
+  hold->thread = cur;
+  list_push_back (&rw->holders, &hold->elem);
+
+  rwlock_update_priority (rw);
+  if (!thread_mlfqs && rw->priority > cur->priority)
+    donate (cur, rw->priority);
+}
+
+/* Drops the current thread's hold on RW, after the caller updated
+   RW's reader or writer state, and wakes up the threads that may
+   now acquire RW: the first waiting writer if there is one,
+   otherwise every waiting reader.  Then restores the current
+   thread's priority.  Interrupts must be off. */
+static void
+rwlock_release (struct rwlock *rw)
+{
+  struct thread *cur = thread_current ();
+  int i;
+
+  for (i = 0; i < RWLOCK_HOLD_CNT; i++)
+    if (cur->rwlock_holds[i].rwlock == rw)
+      {
+        list_remove (&cur->rwlock_holds[i].elem);
+        cur->rwlock_holds[i].rwlock = NULL;
+        break;
+      }
+
+  if (rw->readers == 0 && rw->writer == NULL)
+    {
+      if (!list_empty (&rw->write_waiters))
+        thread_unblock (list_entry (list_pop_front (&rw->write_waiters),
+                                    struct thread, elem));
+      else if (rw->waiting_writers == 0)
+        while (!list_empty (&rw->read_waiters))
+          thread_unblock (list_entry (list_pop_front (&rw->read_waiters),
+                                      struct thread, elem));
+    }
+
+  rwlock_update_priority (rw);
+  if (!thread_mlfqs)
+    donate (cur, next_donated_priority (cur));
+}
+
+/* Sets RW's priority to the highest priority of its waiters, or to
+   -1 if there are none.  Wait lists are ordered by priority. */
+static void
+rwlock_update_priority (struct rwlock *rw)
+{
+  int priority = -1;
+
+  if (!list_empty (&rw->read_waiters))
+    priority = list_entry (list_front (&rw->read_waiters),
+                           struct thread, elem)->priority;
+  if (!list_empty (&rw->write_waiters))
+    {
+      int writer_priority = list_entry (list_front (&rw->write_waiters),
+                                        struct thread, elem)->priority;
+      if (writer_priority > priority)
+        priority = writer_priority;
+    }
+  rw->priority = priority;
+}
+
+/* Prints contention statistics for the named locks that spent the
+   most time waited for, most contended first. */
+void
+lock_print_stats (void)
+{
+  struct lock_profile *sorted[LOCK_PROFILE_CNT];
+  size_t i, j;
+
+  /* Insertion sort by total wait time, then by contended count. */
+  for (i = 0; i < lock_profile_cnt; i++)
+    {
+      struct lock_profile *p = &lock_profiles[i];
+
+      for (j = i; j > 0; j--)
+        {
+          struct lock_profile *q = sorted[j - 1];
+          if (q->wait_ticks > p->wait_ticks
+              || (q->wait_ticks == p->wait_ticks
+                  && q->contended_cnt >= p->contended_cnt))
+            break;
+          sorted[j] = q;
+        }
+      sorted[j] = p;
+    }
+
+  for (i = 0; i < lock_profile_cnt && i < LOCK_REPORT_CNT; i++)
+    {
+      struct lock_profile *p = sorted[i];
+      printf ("Lock %s: %lld acquires, %lld contended, "
+              "%lld wait ticks (max %lld), %lld hold ticks (max %lld)\n",
+              p->name, p->acquire_cnt, p->contended_cnt,
+              p->wait_ticks, p->max_wait_ticks,
+              p->hold_ticks, p->max_hold_ticks);
+    }
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
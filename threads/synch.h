@@ -23,13 +23,47 @@ struct lock {
   int priority;               /* Highest priority between the thread(s)
                                    trying to acquire this lock. */
   struct list_elem elem;      /* List element for locks list. */
+  struct lock_profile *profile; /* Contention statistics, only for
+                                   locks named by lock_set_name(). */
 };
 
 void lock_init (struct lock *);
+void lock_set_name (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+void lock_print_stats (void);
+
+/* Readers-writer lock. */
+struct rwlock {
+  unsigned readers;           /* # of threads holding it for reading. */
+  struct thread *writer;      /* Thread holding it for writing, if any. */
+  unsigned waiting_writers;   /* # of threads trying to write. */
+  struct list holders;        /* `struct rwlock_hold' of each holder. */
+  struct list read_waiters;   /* Threads waiting to read. */
+  struct list write_waiters;  /* Threads waiting to write. */
+  int priority;               /* Highest priority between the thread(s)
+                                   waiting for this lock. */
+};
+
+/* A thread's hold on a readers-writer lock.  Each thread has
+   RWLOCK_HOLD_CNT of these, so it can hold at most that many
+   readers-writer locks at a time. */
+#define RWLOCK_HOLD_CNT 4
+struct rwlock_hold {
+  struct rwlock *rwlock;      /* Held lock, or null if unused. */
+  struct thread *thread;      /* Holding thread. */
+  struct list_elem elem;      /* List element for holders list. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
+void rwlock_donate (struct rwlock *, int priority);
 
 /* Condition variable. */
 struct condition {
@@ -25,9 +25,16 @@
 /* Maximum prority for advanced scheduler. */
 #define ADV_PRI_MAX_ 63;
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Run queue of processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO list per priority level.  Bit P of
+   READY_MASK is set iff READY_QUEUES[P] is non-empty, so the
+   highest ready priority is found with a single bit scan.  The
+   mask is kept as two 32-bit words to stay clear of 64-bit
+   helpers from libgcc. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint32_t ready_mask[(PRI_MAX + 32) / 32];
+static size_t ready_cnt;        /* # of threads in the run queue. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -42,6 +49,17 @@ static struct thread *initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
+/* Pages of exited threads, kept for reuse by thread_create() so
+   that a create/exit pair need not go through the page
+   allocator or zero a whole page.  Only the struct thread at the
+   bottom of a recycled page is cleared; the stack above it is
+   overwritten as the new thread uses it. */
+#define THREAD_PAGE_CACHE_SIZE 16
+static void *thread_page_cache[THREAD_PAGE_CACHE_SIZE];
+static size_t thread_page_cache_cnt;
+static long long thread_pages_reused;    /* # of pages from the cache. */
+static long long thread_pages_allocated; /* # of pages from palloc. */
+
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame {
   void *eip;                  /* Return address. */
@@ -58,10 +76,40 @@ static long long user_ticks;    /* # of timer ticks in user programs. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 
+/* Histogram of run queue wait times.  Bucket 0 counts waits of 0
+   ticks, bucket I > 0 counts waits of 2**(I-1) to 2**I - 1 ticks,
+   and the last bucket also counts every longer wait. */
+#define READY_WAIT_BUCKETS 16
+static long long ready_wait_hist[READY_WAIT_BUCKETS];
+
+/* Scheduling statistics of the most recently exited threads, so
+   that threads that are gone by the time statistics are printed,
+   such as user processes at shutdown, are still reported.  Once
+   EXITED_STATS_CNT threads have exited, each exit overwrites the
+   oldest record, but every exit is still added to EXITED_TOTAL. */
+#define EXITED_STATS_CNT 32
+struct exited_stats {
+  tid_t tid;                  /* Thread identifier. */
+  char name[16];              /* Thread name. */
+  struct thread_stats stats;  /* Statistics at exit. */
+};
+static struct exited_stats exited_stats[EXITED_STATS_CNT];
+static size_t exited_cnt;               /* # of threads that exited. */
+static struct thread_stats exited_total; /* Sum over exited threads. */
+
 /* advanced scheduler */
 /* estimates the average number of threads ready to run over the past minute. */
 fixed_float load_avg;
 
+/* advanced scheduler */
+/* Factor by which recent_cpu decays each second, 2*load_avg / (2*load_avg + 1).
+   Recomputed once per second, right after load_avg. */
+static fixed_float recent_cpu_decay;
+
+/* advanced scheduler */
+/* Number of once-per-second updates done since boot. */
+static int64_t mlfqs_seconds;
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
@@ -69,7 +117,14 @@ bool thread_mlfqs;
 
 static void calculate_priority_advanced (struct thread *, void *);
 static void calculate_recent_cpu_advanced (struct thread *, void *);
-static void update_load_avg (void);
+static void update_load_avg (int ready_threads);
+static void mlfqs_update_second (int ready_threads);
+static void mlfqs_catch_up (struct thread *);
+
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static int ready_max_priority (void);
+static void set_thread_priority (struct thread *, int priority);
 
 static void kernel_thread (thread_func *, void *aux);
 
@@ -79,7 +134,14 @@ static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
+static struct thread *thread_page_get (void);
+static void thread_page_put (struct thread *);
 static void schedule (void);
+static void account_switch (struct thread *cur, struct thread *next);
+static void print_thread_stats (struct thread *, void *aux);
+static void print_stats (tid_t, const char *name,
+                         const struct thread_stats *, bool exited);
+static void record_exit (struct thread *);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
 
@@ -99,10 +161,14 @@ static tid_t allocate_tid (void);
                                         void
                                         thread_init (void)
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  lock_set_name (&tid_lock, "tid");
+  for (i = PRI_MIN; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
   list_init (&all_list);
 
   /* Set up a thread structure for the running thread. */
@@ -136,12 +202,13 @@ thread_start (void)
 }
 
 /* Advanced Scheduler */
-/* Recalculate priority for the given thread. */
+/* Recalculate priority for the given thread, clamped to the range
+   PRI_MIN..PRI_MAX.  A ready thread is moved to its new run queue. */
 void
 calculate_priority_advanced (struct thread *t, void *aux UNUSED)
 {
-  t->priority =
-    63 -
+  int priority =
+    PRI_MAX -
     convert_real_to_int_nearest (
       div_real_by_int (
         t->recent_cpu,
@@ -149,6 +216,12 @@ calculate_priority_advanced (struct thread *t, void *aux UNUSED)
       )
     ) -
     (t->nice * 2);
+
+  if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  else if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  set_thread_priority (t, priority);
 }
 
 /* Advanced Scheduler */
@@ -156,28 +229,104 @@ calculate_priority_advanced (struct thread *t, void *aux UNUSED)
 void
 calculate_recent_cpu_advanced (struct thread *t, void *aux UNUSED)
 {
-  fixed_float load_average_term =
-    div_real_by_real (
-      mul_real_by_int (load_avg, 2),
-      add_int_to_real (
-        1,
-        mul_real_by_int (load_avg, 2)
-      )
-    );
   t->recent_cpu =
     add_int_to_real (
       t->nice,
       mul_real_by_real (
-        load_average_term,
+        recent_cpu_decay,
         t->recent_cpu
       )
     );
 }
 
+/* Advanced Scheduler */
+/* Brings T's recent_cpu up to date with the last once-per-second
+   update, then recalculates T's priority.  A thread that was blocked
+   for K updates gets all K decays applied at once:
+
+     recent_cpu = d^K * recent_cpu + nice * (1 - d^K) / (1 - d)
+
+   where d is recent_cpu_decay, so that 1 / (1 - d) = 2*load_avg + 1.
+   This uses the current load_avg for all K updates, which is only
+   an approximation when load_avg changed while T was blocked. */
+static void
+mlfqs_catch_up (struct thread *t)
+{
+  int64_t missed = mlfqs_seconds - t->recent_cpu_second;
+  fixed_float decay;
+
+  if (missed == 0)
+    return;
+
+  if (missed == 1)
+    calculate_recent_cpu_advanced (t, NULL);
+  else
+    {
+      decay = pow_real_by_int (recent_cpu_decay, missed);
+      t->recent_cpu =
+        add_real_to_real (
+          mul_real_by_real (decay, t->recent_cpu),
+          mul_real_by_real (
+            mul_real_by_int (
+              sub_real_from_real (decay, convert_int_to_real (1)),
+              t->nice
+            ),
+            add_int_to_real (1, mul_real_by_int (load_avg, 2))
+          )
+        );
+    }
+  t->recent_cpu_second = mlfqs_seconds;
+  calculate_priority_advanced (t, NULL);
+}
+
 /* advanced scheduler */
-/* update system load average */
+/* Once-per-second update of the load average, and of recent_cpu and
+   priority for the running and ready threads.  Blocked threads are
+   brought up to date by mlfqs_catch_up() when they are unblocked, so
+   the work done here grows with the number of runnable threads only.
+   READY_THREADS is the number of threads either running or ready to
+   run during the tick. */
+static void
+mlfqs_update_second (int ready_threads)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e, *next;
+  int pri;
+
+  update_load_avg (ready_threads);
+  recent_cpu_decay =
+    div_real_by_real (
+      mul_real_by_int (load_avg, 2),
+      add_int_to_real (
+        1,
+        mul_real_by_int (load_avg, 2)
+      )
+    );
+  mlfqs_seconds++;
+
+  if (cur != idle_thread)
+    mlfqs_catch_up (cur);
+
+  /* A thread whose priority changes moves to the back of another run
+     queue, possibly one not visited yet.  Its up-to-date recent_cpu
+     makes mlfqs_catch_up() skip it the second time around. */
+  for (pri = PRI_MAX; pri >= PRI_MIN; pri--)
+    for (e = list_begin (&ready_queues[pri]); e != list_end (&ready_queues[pri]);
+         e = next)
+      {
+        next = list_next (e);
+        mlfqs_catch_up (list_entry (e, struct thread, elem));
+      }
+
+  /* yield on return, a ready thread may now have a higher priority */
+  intr_yield_on_return ();
+}
+
+/* advanced scheduler */
+/* update system load average, given the number of threads that are
+   either running or ready to run */
 void
-update_load_avg (void)
+update_load_avg (int ready_threads)
 {
   load_avg =
     add_real_to_real (
@@ -187,7 +336,7 @@ update_load_avg (void)
       ),
       mul_real_by_int (
         new_fixed_point_real_nom_dom (1, 60),
-        list_size (&ready_list) + (thread_current () != idle_thread)
+        ready_threads
       )
     );
 }
@@ -205,18 +354,9 @@ thread_tick (void)
       if (t != idle_thread)
         thread_current ()->recent_cpu = add_int_to_real (1, thread_current ()->recent_cpu);
 
-      /* recalculate every recent_cpu value */
+      /* recalculate load_avg, recent_cpu and priorities */
       if (timer_ticks () % TIMER_FREQ == 0)
-        {
-          update_load_avg ();
-          thread_foreach (calculate_recent_cpu_advanced, NULL);
-
-          /* update priority for each thread then sort the list and yiels on return */
-          thread_foreach (calculate_priority_advanced, NULL);
-          list_sort (&ready_list, greater_priority, NULL);
-
-          intr_yield_on_return ();
-        }
+        mlfqs_update_second (ready_cnt + (t != idle_thread));
 
       /* advanced scheduler */
       /* recalculate running thread every 4 ticks*/
@@ -228,6 +368,7 @@ thread_tick (void)
         }
     }
   /* Update statistics. */
+  t->stats.run_ticks++;
   if (t == idle_thread)
     idle_ticks++;
 #ifdef USERPROG
@@ -242,12 +383,155 @@ thread_tick (void)
     intr_yield_on_return ();
 }
 
-/* Prints thread statistics. */
+/* Called by the timer interrupt handler for a tick that passed
+   while the idle thread was running without a periodic timer (see
+   timer_idle_enter()), but that is only being accounted for now.
+   The tick is charged to the idle thread, whichever thread happens
+   to be running at the moment. */
+void
+thread_tick_idle (void)
+{
+  idle_thread->stats.run_ticks++;
+  idle_ticks++;
+
+  /* Nothing was running or ready to run during the tick. */
+  if (thread_mlfqs && timer_ticks () % TIMER_FREQ == 0)
+    mlfqs_update_second (0);
+}
+
+/* Prints thread statistics, including the scheduling statistics
+   of every thread that still exists and of the threads that
+   exited most recently. */
 void
 thread_print_stats (void)
 {
+  enum intr_level old_level;
+  size_t first, j;
+  int i;
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread: %lld pages reused, %lld pages allocated\n",
+          thread_pages_reused, thread_pages_allocated);
+
+  old_level = intr_disable ();
+  thread_foreach (print_thread_stats, NULL);
+  first = exited_cnt > EXITED_STATS_CNT ? exited_cnt - EXITED_STATS_CNT : 0;
+  if (first > 0)
+    printf ("Thread: %zu earlier exited threads not shown\n", first);
+  for (j = first; j < exited_cnt; j++)
+    {
+      struct exited_stats *e = &exited_stats[j % EXITED_STATS_CNT];
+      print_stats (e->tid, e->name, &e->stats, true);
+    }
+  if (exited_cnt > 0)
+    printf ("Thread: %zu exited threads: %lld running, %lld ready, "
+            "%lld blocked ticks, %u voluntary, %u involuntary switches\n",
+            exited_cnt, exited_total.run_ticks, exited_total.ready_ticks,
+            exited_total.blocked_ticks, exited_total.voluntary_switches,
+            exited_total.involuntary_switches);
+  intr_set_level (old_level);
+
+  for (i = 0; i < READY_WAIT_BUCKETS; i++)
+    if (ready_wait_hist[i] != 0)
+      {
+        if (i == 0)
+          printf ("Run queue: %lld waits of 0 ticks\n", ready_wait_hist[i]);
+        else if (i == READY_WAIT_BUCKETS - 1)
+          printf ("Run queue: %lld waits of %d+ ticks\n",
+                  ready_wait_hist[i], 1 << (i - 1));
+        else
+          printf ("Run queue: %lld waits of %d-%d ticks\n",
+                  ready_wait_hist[i], 1 << (i - 1), (1 << i) - 1);
+      }
+}
+
+/* Prints the scheduling statistics of thread T. */
+static void
+print_thread_stats (struct thread *t, void *aux UNUSED)
+{
+  print_stats (t->tid, t->name, &t->stats, false);
+}
+
+/* Prints the scheduling statistics S of the thread with the given
+   TID and NAME, noting whether it has EXITED. */
+static void
+print_stats (tid_t tid, const char *name, const struct thread_stats *s,
+             bool exited)
+{
+  printf ("Thread %d (%s%s): %lld running, %lld ready, %lld blocked ticks, "
+          "%u voluntary, %u involuntary switches\n",
+          tid, name, exited ? ", exited" : "", s->run_ticks, s->ready_ticks,
+          s->blocked_ticks, s->voluntary_switches, s->involuntary_switches);
+}
+
+/* Keeps the scheduling statistics of T, which is exiting. */
+static void
+record_exit (struct thread *t)
+{
+  struct exited_stats *e = &exited_stats[exited_cnt++ % EXITED_STATS_CNT];
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  e->tid = t->tid;
+  strlcpy (e->name, t->name, sizeof e->name);
+  e->stats = t->stats;
+
+  exited_total.run_ticks += t->stats.run_ticks;
+  exited_total.ready_ticks += t->stats.ready_ticks;
+  exited_total.blocked_ticks += t->stats.blocked_ticks;
+  exited_total.voluntary_switches += t->stats.voluntary_switches;
+  exited_total.involuntary_switches += t->stats.involuntary_switches;
+}
+
+/* Copies the scheduling statistics of the thread with the given TID
+   into *STATS.  Time spent in the thread's current status so far is
+   included.  A thread that has exited recently enough to still have
+   a record is found too.  Returns false if there is no such
+   thread. */
+bool
+thread_get_stats (tid_t tid, struct thread_stats *stats)
+{
+  struct list_elem *e;
+  enum intr_level old_level;
+  bool found = false;
+
+  old_level = intr_disable ();
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+      if (t->tid == tid)
+        {
+          *stats = t->stats;
+          if (t->status == THREAD_READY)
+            stats->ready_ticks += timer_ticks () - t->status_ticks;
+          else if (t->status == THREAD_BLOCKED && t != idle_thread)
+            stats->blocked_ticks += timer_ticks () - t->status_ticks;
+          found = true;
+          break;
+        }
+    }
+  if (!found)
+    {
+      size_t first = (exited_cnt > EXITED_STATS_CNT
+                      ? exited_cnt - EXITED_STATS_CNT : 0);
+      size_t i;
+
+      for (i = exited_cnt; i > first; i--)
+        {
+          struct exited_stats *x = &exited_stats[(i - 1) % EXITED_STATS_CNT];
+          if (x->tid == tid)
+            {
+              *stats = x->stats;
+              found = true;
+              break;
+            }
+        }
+    }
+  intr_set_level (old_level);
+
+  return found;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -279,7 +563,7 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = thread_page_get ();
   if (t == NULL)
     return TID_ERROR;
 
@@ -290,6 +574,7 @@ thread_create (const char *name, int priority,
   /* advanced scheduler */
   /* set values for the thread. */
   t->recent_cpu = thread_current ()->recent_cpu;
+  t->recent_cpu_second = mlfqs_seconds;
   t->nice = thread_current ()->nice;
   if (thread_mlfqs)
     calculate_priority_advanced (t, NULL);
@@ -355,7 +640,11 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_insert_ordered (&ready_list, &(t)->elem, greater_priority, NULL);
+  if (thread_mlfqs)
+    mlfqs_catch_up (t);
+  ready_push (t);
+  t->stats.blocked_ticks += timer_ticks () - t->status_ticks;
+  t->status_ticks = timer_ticks ();
   t->status = THREAD_READY;
   /* Preempt unblocked thread only if it has a higher priority than
   currently running thread and kernel is not currently executing an
@@ -415,6 +704,7 @@ thread_exit (int status)
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
+  record_exit (thread_current ());
   list_remove (&thread_current ()->allelem);
   thread_current ()->status = THREAD_DYING;
   schedule ();
@@ -432,9 +722,9 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  /* Insert thread in ready queue, ready queue is descendingly ordered by priority. */
+  /* Append thread to the run queue of its priority. */
   if (cur != idle_thread)
-    list_insert_ordered (&ready_list, &cur->elem, greater_priority, NULL);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -489,9 +779,9 @@ donate (struct thread *t, int priority)
   while (temp_thread != NULL)
     {
 
-      temp_thread->priority = priority;
+      set_thread_priority (temp_thread, priority);
 
-      if (temp_thread->status == THREAD_READY || temp_thread->status == THREAD_BLOCKED)
+      if (temp_thread->status == THREAD_BLOCKED)
         list_modify_ordered (&temp_thread->elem, &greater_priority, NULL);
 
       if (temp_thread->lock_waiting)
@@ -503,7 +793,12 @@ donate (struct thread *t, int priority)
           temp_thread = temp_thread->lock_waiting->holder;
         }
       else
-        temp_thread = NULL;
+        {
+          /* A readers-writer lock may have many holders. */
+          if (temp_thread->rwlock_waiting != NULL)
+            rwlock_donate (temp_thread->rwlock_waiting, priority);
+          temp_thread = NULL;
+        }
     }
 
   //preempt
@@ -514,12 +809,14 @@ donate (struct thread *t, int priority)
 /* Selectes and returns the next priority that T shall donate.
 The next donated priority is T's default one if T possesses
 no synchronization primitives(Locks specifically). If it does, then
-the top most priority is selected and returned.
+the top most priority is selected and returned.  Readers-writer
+locks held by T can only raise that priority.
 */
 int
 next_donated_priority (struct thread *t)
 {
   int new_priority;
+  int i;
   ASSERT (t != NULL);
 
   if (list_empty (&t->locks))
@@ -527,6 +824,11 @@ next_donated_priority (struct thread *t)
   else
     new_priority = list_entry (list_front (&t->locks),
   struct lock, elem)->priority;
+
+  for (i = 0; i < RWLOCK_HOLD_CNT; i++)
+    if (t->rwlock_holds[i].rwlock != NULL
+        && t->rwlock_holds[i].rwlock->priority > new_priority)
+      new_priority = t->rwlock_holds[i].rwlock->priority;
   return new_priority;
 }
 
@@ -591,10 +893,16 @@ idle (void *idle_started_ UNUSED)
 
   for (;;)
     {
-      /* Let someone else run. */
+      /* Let someone else run, bringing the timer back to periodic
+         ticks first if it was stopped while we were halted. */
       intr_disable ();
+      timer_idle_exit ();
       thread_block ();
 
+      /* Nothing else is ready to run.  In tickless mode, stop the
+         periodic timer until the next sleeper is due. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -660,10 +968,60 @@ init_thread (struct thread *t, const char *name, int priority)
   list_init (&(t)->locks);
   t->default_priority = priority;
   t->lock_waiting = NULL;
+  t->status_ticks = timer_ticks ();
   t->magic = THREAD_MAGIC;
   list_push_back (&all_list, &t->allelem);
 }
 
+/* Returns a page for a new thread, preferably one recycled from
+   an exited thread, or a null pointer if no memory is available.
+   The contents of the page are unspecified; init_thread() clears
+   the struct thread part of it. */
+static struct thread *
+thread_page_get (void)
+{
+  struct thread *t = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (thread_page_cache_cnt > 0)
+    {
+      t = thread_page_cache[--thread_page_cache_cnt];
+      thread_pages_reused++;
+    }
+  intr_set_level (old_level);
+
+  if (t == NULL)
+    {
+      t = palloc_get_page (PAL_ZERO);
+      if (t != NULL)
+        {
+          old_level = intr_disable ();
+          thread_pages_allocated++;
+          intr_set_level (old_level);
+        }
+    }
+  return t;
+}
+
+/* Releases the page of dead thread T, keeping it for reuse if the
+   cache has room.  Interrupts must be off. */
+static void
+thread_page_put (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (is_thread (t));
+
+  if (thread_page_cache_cnt < THREAD_PAGE_CACHE_SIZE)
+    {
+      /* Make stale pointers to T fail is_thread(). */
+      t->magic = 0;
+      thread_page_cache[thread_page_cache_cnt++] = t;
+    }
+  else
+    palloc_free_page (t);
+}
+
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
    returns a pointer to the frame's base. */
 static void *
@@ -685,14 +1043,71 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void)
 {
-  if (list_empty (&ready_list))
+  struct thread *t;
+
+  if (ready_cnt == 0)
     return idle_thread;
-  else
+
+  t = list_entry (list_front (&ready_queues[ready_max_priority ()]),
+                  struct thread, elem);
+  ready_remove (t);
+  return t;
+}
+
+/* Appends T to the back of the run queue for its priority. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask[t->priority / 32] |= 1u << (t->priority % 32);
+  ready_cnt++;
+}
+
+/* Removes T from the run queue for its priority. */
+static void
+ready_remove (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_mask[t->priority / 32] &= ~(1u << (t->priority % 32));
+  ready_cnt--;
+}
+
+/* Returns the highest priority with a non-empty run queue, or -1
+   if every run queue is empty. */
+static int
+ready_max_priority (void)
+{
+  int i;
+
+  for (i = sizeof ready_mask / sizeof *ready_mask - 1; i >= 0; i--)
+    if (ready_mask[i] != 0)
+      return i * 32 + 31 - __builtin_clz (ready_mask[i]);
+  return -1;
+}
+
+/* Sets T's effective priority to PRIORITY.  If T is ready, it is
+   moved to the back of the run queue for its new priority. */
+static void
+set_thread_priority (struct thread *t, int priority)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (t->status == THREAD_READY && t->priority != priority)
     {
-      // list_sort (&ready_list, greater_priority, NULL);
-      return list_entry (list_pop_front (&ready_list),
-      struct thread, elem);
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
     }
+  else
+    t->priority = priority;
+
+  intr_set_level (old_level);
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -737,7 +1152,7 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread)
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      thread_page_put (prev);
     }
 }
 
@@ -760,10 +1175,40 @@ schedule (void)
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      account_switch (cur, next);
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
+/* Updates scheduling statistics for a switch from CUR, whose status
+   has already been changed from running, to NEXT. */
+static void
+account_switch (struct thread *cur, struct thread *next)
+{
+  int64_t now = timer_ticks ();
+
+  if (cur->status == THREAD_BLOCKED)
+    cur->stats.voluntary_switches++;
+  else if (cur->status == THREAD_READY)
+    cur->stats.involuntary_switches++;
+  cur->status_ticks = now;
+
+  /* The idle thread runs without going through the run queue. */
+  if (next->status == THREAD_READY)
+    {
+      int64_t wait = now - next->status_ticks;
+      int bucket = 0;
+
+      while (wait >> bucket != 0 && bucket < READY_WAIT_BUCKETS - 1)
+        bucket++;
+      ready_wait_hist[bucket]++;
+      next->stats.ready_ticks += wait;
+    }
+  next->status_ticks = now;
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void)
@@ -777,18 +1222,6 @@ allocate_tid (void)
   return tid;
 }
 
-/* Returns true if thread A has less sleep time than thread B, false otherwise. */
-bool
-less_sleep (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
-{
-  struct thread *thread_a = list_entry (a,
-  struct thread, elem);
-  struct thread *thread_b = list_entry (b,
-  struct thread, elem);
-
-  return thread_a->sleep_ticks < thread_b->sleep_ticks;
-}
-
 /* Returns true if thread A has greater priotity than thread B, false otherwise. */
 bool
 greater_priority (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
@@ -808,10 +1241,8 @@ void
 test_preempt (void)
 {
   enum intr_level old_level = intr_disable ();
-  if (!list_empty (&ready_list) && preempts (list_entry (
-    list_front (&ready_list),
-    struct thread, elem)))
-  thread_yield ();
+  if (ready_max_priority () > thread_current ()->priority)
+    thread_yield ();
 
   intr_set_level (old_level);
 }
@@ -4,7 +4,11 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#ifdef VM
+#include <hash.h>
+#endif
 #include "threads/fixed-point.h"
+#include "threads/synch.h"
 
 /* States in a thread's life cycle. */
 enum thread_status {
@@ -24,6 +28,17 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Scheduling statistics of a thread.  Times are in timer ticks.
+   A switch is voluntary if the thread blocked, and involuntary if
+   it was still ready to run, whether preempted or yielding. */
+struct thread_stats {
+  unsigned voluntary_switches;        /* Switches away after blocking. */
+  unsigned involuntary_switches;      /* Switches away while still ready. */
+  int64_t run_ticks;                  /* Ticks spent running. */
+  int64_t ready_ticks;                /* Ticks spent ready, waiting to run. */
+  int64_t blocked_ticks;              /* Ticks spent blocked. */
+};
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -92,6 +107,9 @@ struct thread {
                                            list when they are first acquire and removed when they are
                                            released. */
   struct lock *lock_waiting;          /* Poniter to the lock which thread is waiting on. */
+  struct rwlock *rwlock_waiting;      /* Readers-writer lock which thread is waiting on. */
+  struct rwlock_hold rwlock_holds[RWLOCK_HOLD_CNT];
+                                      /* Readers-writer locks held by thread. */
 
   int64_t sleep_ticks;                /* Ticks till thread unblocks from sleep
                                           starting from OS boot time. */
@@ -99,9 +117,14 @@ struct thread {
   /* advanced scheduler */
   int nice;                           /* nice value for the thread. */
   fixed_float recent_cpu;
+  int64_t recent_cpu_second;          /* Once-per-second update that recent_cpu
+                                          was last brought up to date with. */
 
   struct list_elem allelem;           /* List element for all threads list. */
 
+  struct thread_stats stats;          /* Scheduling statistics. */
+  int64_t status_ticks;               /* Tick at which status last changed. */
+
   /* Shared between thread.c and synch.c. */
   struct list_elem elem;              /* List element. */
 
@@ -109,6 +132,13 @@ struct thread {
   /* Owned by userprog/process.c. */
   uint32_t *pagedir;                  /* Page directory. */
 #endif
+#ifdef VM
+  /* Owned by vm/page.c. */
+  struct hash pages;                  /* Supplemental page table. */
+  struct file *exec_file;             /* Executable pages load from. */
+  void *user_esp;                     /* User stack pointer on entry to
+                                         the latest system call. */
+#endif
 
   /* Owned by thread.c. */
   unsigned magic;                     /* Detects stack overflow. */
@@ -123,7 +153,9 @@ void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_tick_idle (void);
 void thread_print_stats (void);
+bool thread_get_stats (tid_t, struct thread_stats *);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -156,13 +188,6 @@ void donate (struct thread *, int);
 int next_donated_priority (struct thread *);
 int next_thread_to_run_priority (void);
 
-/* Compares the sleep time of two threads list elements A and B, given
-   auxiliary data AUX.  Returns true if A has less sleep time than B, or
-   false if A has greater sleep time than or equal to B. */
-bool less_sleep (const struct list_elem *a,
-                 const struct list_elem *b,
-                 void *aux);
-
 /* Compares the priority of two threads list elements A and B, given
    auxiliary data AUX.  Returns true if A has greater(or equal) priority
    than B, or false if A has less priority than B. */
@@ -5,6 +5,9 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "userprog/syscall.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -155,6 +158,21 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* Bring in a page that has not been loaded yet, grow the stack,
+     or copy a page shared copy-on-write, whether the process
+     touched it directly or through a system call.  In a system
+     call, f->esp is the kernel's stack pointer, so use the user's
+     saved on entry. */
+  if (not_present
+      && (page_load (fault_addr)
+          || page_grow_stack (fault_addr, user ? f->esp
+                                               : thread_current ()->user_esp)))
+    return;
+  if (!not_present && write && page_copy_on_write (fault_addr))
+    return;
+#endif
+
   /* If casued by the kernel, suppress the fault.
      Note that this block exists to point a return code to
      the calling system call; there's no way to return an error
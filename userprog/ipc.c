@@ -2,6 +2,7 @@
 #include <string.h>
 #include "threads/synch.h"
 #include "threads/malloc.h"
+#include "threads/kmem.h"
 #include "userprog/ipc.h"
 
 
@@ -22,11 +23,18 @@ struct waiting_process {
 struct list sent_mail;
 struct list waiting_list;
 
+/* Caches of message and waiting_process structs. */
+static struct kmem_cache message_cache;
+static struct kmem_cache waiting_process_cache;
+
 
 void ipc_init (void)
 {
   list_init (&sent_mail);
   list_init (&waiting_list);
+  kmem_cache_init (&message_cache, "message", sizeof (struct message), NULL);
+  kmem_cache_init (&waiting_process_cache, "waiting_process",
+                   sizeof (struct waiting_process), NULL);
 }
 
 /* Get list_elem of message with given signature from sent mail, return NULL if
@@ -49,7 +57,7 @@ void ipc_send (char *signature, int data)
   struct list_elem *e;
 
   /* Construct a new message. */
-  struct message *msg = malloc (sizeof (struct message));
+  struct message *msg = kmem_cache_alloc (&message_cache);
   msg->signature = malloc (sizeof (char *));
   strlcpy (msg->signature, signature, strlen (signature) + 1);
   msg->data = data;
@@ -83,13 +91,13 @@ int ipc_receive (char *signature)
       list_remove (e);
       data = msg->data;
       free (msg->signature);
-      free (msg);
+      kmem_cache_free (&message_cache, msg);
       return data;
     }
 
   /* If never found a message with this signature, wait for someone to pass a message with this
   signature using a semaphore. */
-  struct waiting_process *proc = malloc (sizeof (struct waiting_process));
+  struct waiting_process *proc = kmem_cache_alloc (&waiting_process_cache);
   proc->signature = malloc (sizeof (char *));
   strlcpy (proc->signature, signature, strlen (signature) + 1);
 
@@ -110,9 +118,9 @@ int ipc_receive (char *signature)
       list_remove (&proc->elem);
       data = msg->data;
       free (msg->signature);
-      free (msg);
+      kmem_cache_free (&message_cache, msg);
       free (proc->signature);
-      free (proc);
+      kmem_cache_free (&waiting_process_cache, proc);
       return data;
     }
 
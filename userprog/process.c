@@ -8,6 +8,7 @@
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
 #include "userprog/ipc.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -19,11 +20,28 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
+#include "threads/kmem.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 #define BUFSIZE 100
 
 static thread_func start_process NO_RETURN;
+#ifdef VM
+static thread_func fork_process NO_RETURN;
+
+/* Passed by process_fork() to the child's fork_process(). */
+struct fork_args
+  {
+    struct thread *parent;      /* Forking thread. */
+    struct intr_frame if_;      /* Parent's user state at the fork. */
+  };
+#endif
 static struct list all_processes_list;
 
+/* Cache of process structs. */
+static struct kmem_cache process_cache;
+
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
 /* Parse arguments passed in 'file_name' to a bunch of separate arguments
@@ -36,10 +54,12 @@ void get_process_name (char *, char **);
 void process_init (void)
 {
   list_init (&all_processes_list);
-  struct process *parent = (struct process *) malloc (sizeof (struct process));
+  kmem_cache_init (&process_cache, "process", sizeof (struct process), NULL);
+  struct process *parent = kmem_cache_alloc (&process_cache);
   parent->pid = thread_tid ();
   list_init (&parent->children_processes);
   list_init (&parent->files);
+  list_init (&parent->mappings);
   list_push_back (&all_processes_list, &parent->allelem);
 }
 
@@ -135,7 +155,7 @@ start_process (void *file_name_)
     }
 
   /* Construct a process struct element and add it to global processes list. */
-  struct process *proc = (struct process *) malloc (sizeof (struct process));
+  struct process *proc = kmem_cache_alloc (&process_cache);
   if (proc == NULL)
     {
       /* Send a message to process waiting in `process_execute ()` with -1
@@ -153,6 +173,7 @@ start_process (void *file_name_)
   proc->executable = file;
   list_init (&proc->children_processes);
   list_init (&proc->files);
+  list_init (&proc->mappings);
   list_push_back (&all_processes_list, &proc->allelem);
 
   /* Send a message to process waiting in `process_execute ()` with `tid/pid`
@@ -170,6 +191,119 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Starts a new process that is a copy of the running one,
+   resuming user code with the registers in IF, the frame of the
+   fork system call, except that it sees a return value of 0.
+   Pages are shared copy-on-write rather than copied, so this
+   does not depend on how much memory the process is using.
+   Returns the new process's pid, or TID_ERROR if it cannot be
+   created.  Requires virtual memory; without it, always fails. */
+pid_t
+process_fork (const struct intr_frame *if_ UNUSED)
+{
+#ifdef VM
+  struct fork_args args;
+  char buf[BUFSIZE];
+  tid_t tid;
+
+  args.parent = thread_current ();
+  args.if_ = *if_;
+  tid = thread_create (thread_name (), PRI_DEFAULT, fork_process, &args);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  /* Wait for IPC message receiving of pid.  Until then the child
+     is using ARGS and our address space. */
+  snprintf (buf, BUFSIZE, "fork %d", tid);
+  pid_t pid = ipc_receive (buf);
+
+  if (pid != -1)
+    {
+      struct process *proc = get_process (thread_tid ());
+      list_push_back (&proc->children_processes, &get_process (pid)->elem);
+    }
+  return pid;
+#else
+  return TID_ERROR;
+#endif
+}
+
+#ifdef VM
+/* A thread function that copies the address space and open
+   files of the process in ARGS_ and starts it running. */
+static void
+fork_process (void *args_)
+{
+  struct fork_args *args = args_;
+  struct thread *t = thread_current ();
+  struct process *parent_proc = get_process (args->parent->tid);
+  struct process *proc = NULL;
+  struct intr_frame if_;
+  char buf[BUFSIZE];
+
+  if_ = args->if_;
+  if_.eax = 0;
+  snprintf (buf, BUFSIZE, "fork %d", t->tid);
+
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL)
+    goto fail;
+  if (!page_table_init ())
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      goto fail;
+    }
+  process_activate ();
+  if (!page_table_fork (args->parent))
+    goto fail;
+
+  proc = kmem_cache_alloc (&process_cache);
+  if (proc == NULL)
+    goto fail;
+  proc->pid = t->tid;
+  list_init (&proc->children_processes);
+  list_init (&proc->files);
+  list_init (&proc->mappings);
+  proc->executable = NULL;
+  if (parent_proc->executable != NULL)
+    {
+      filesys_acquire_external_lock ();
+      proc->executable = file_reopen (parent_proc->executable);
+      if (proc->executable != NULL)
+        file_deny_write (proc->executable);
+      filesys_release_external_lock ();
+      if (proc->executable == NULL)
+        goto fail;
+    }
+  if (!dup_files (&parent_proc->files, &proc->files))
+    goto fail;
+  list_push_back (&all_processes_list, &proc->allelem);
+
+  /* Send a message to the parent waiting in `process_fork ()` with
+     our pid.  After this, ARGS is gone. */
+  ipc_send (buf, t->tid);
+
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+
+fail:
+  if (proc != NULL)
+    {
+      if (proc->executable != NULL)
+        {
+          filesys_acquire_external_lock ();
+          file_allow_write (proc->executable);
+          file_close (proc->executable);
+          filesys_release_external_lock ();
+        }
+      kmem_cache_free (&process_cache, proc);
+    }
+  ipc_send (buf, -1);
+  thread_exit (-1);
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -211,7 +345,7 @@ process_wait (tid_t child_tid)
   /* remove child from childs-list. */
   list_remove (&child_process->elem);
   list_remove (&child_process->allelem);
-  free (child_process);
+  kmem_cache_free (&process_cache, child_process);
 
   return status;
 }
@@ -239,6 +373,9 @@ process_exit (int status)
          directory before destroying the process's page
          directory, or our active page directory will be one
          that's been freed (and cleared). */
+#ifdef VM
+      page_table_destroy ();
+#endif
       cur->pagedir = NULL;
       pagedir_activate (NULL);
       pagedir_destroy (pd);
@@ -351,6 +488,14 @@ load (const char *file_name, void (**eip)(void), void **esp)
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL)
     goto done;
+#ifdef VM
+  if (!page_table_init ())
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      goto done;
+    }
+#endif
   process_activate ();
 
   /* Allocate and parse arguments passed in 'file_name'. */
@@ -369,6 +514,11 @@ load (const char *file_name, void (**eip)(void), void **esp)
       printf ("load: %s: open failed\n", file_name);
       goto done;
     }
+#ifdef VM
+  /* Pages are read from FILE as they are touched, so it stays
+     open until the process exits. */
+  t->exec_file = file;
+#endif
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -453,7 +603,9 @@ load (const char *file_name, void (**eip)(void), void **esp)
 
 done:
   /* We arrive here whether the load is successful or not. */
+#ifndef VM
   file_close (file);
+#endif
   palloc_free_page (argv);
   free (file_name_cp);
   return success;
@@ -461,7 +613,9 @@ done:
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -530,6 +684,24 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  /* Only record where each page comes from.  page_load() reads it
+     in when the process first touches it. */
+  while (read_bytes > 0 || zero_bytes > 0)
+    {
+      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+      size_t page_zero_bytes = PGSIZE - page_read_bytes;
+
+      if (!page_add_file (upage, file, ofs, page_read_bytes, writable))
+        return false;
+
+      read_bytes -= page_read_bytes;
+      zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
+      upage += PGSIZE;
+    }
+  return true;
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0)
     {
@@ -565,6 +737,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       upage += PGSIZE;
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -572,9 +745,18 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp, char **argv, int argc)
 {
-  uint8_t *kpage;
   bool success = false;
 
+#ifdef VM
+  /* The stack is an ordinary zero page, so that it can be evicted
+     like any other.  Load it now rather than faulting it in. */
+  void *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+  success = page_add_file (upage, NULL, 0, 0, true) && page_load (upage);
+  if (!success)
+    return success;
+#else
+  uint8_t *kpage;
+
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL)
     {
@@ -585,6 +767,7 @@ setup_stack (void **esp, char **argv, int argc)
           return success;
         }
     }
+#endif
 
   *esp = PHYS_BASE;
   /* Setup argument in stack. */
@@ -629,6 +812,7 @@ setup_stack (void **esp, char **argv, int argc)
    with palloc_get_page().
    Returns true on success, false if UPAGE is already mapped or
    if memory allocation fails. */
+#ifndef VM
 static bool
 install_page (void *upage, void *kpage, bool writable)
 {
@@ -639,6 +823,7 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
     && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
 
 void
 parse_args(char *file_name, char **argv, int *argc)
@@ -5,8 +5,11 @@
 
 typedef int pid_t;
 
+struct intr_frame;
+
 void process_init (void);
 tid_t process_execute (const char *file_name);
+pid_t process_fork (const struct intr_frame *);
 int process_wait (tid_t);
 void process_exit (int);
 void process_activate (void);
@@ -17,6 +20,7 @@ struct process *get_process (tid_t tid);
 struct process {
   pid_t pid;
   struct list files;
+  struct list mappings;               /* Memory-mapped files (VM only). */
 
   struct list children_processes;
   struct list_elem elem;
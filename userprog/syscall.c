@@ -1,4 +1,5 @@
 #include "userprog/syscall.h"
+#include <round.h>
 #include <stdio.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
@@ -7,13 +8,17 @@
 #include "devices/shutdown.h"
 #include "userprog/process.h"
 #include "threads/synch.h"
-#include "threads/malloc.h"
+#include "threads/kmem.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "devices/input.h"
-#define SYSCALL_COUNT 13
+#ifdef VM
+#include "vm/page.h"
+#endif
+#define SYSCALL_COUNT (SYS_PREALLOCATE + 1)
 
 typedef int pid_t;
+typedef int mapid_t;
 
 int fid = 2;
 
@@ -28,6 +33,25 @@ struct file_elem
   int fid;
 };
 
+/* Cache of file_elem structs. */
+static struct kmem_cache file_elem_cache;
+
+#ifdef VM
+/* A memory-mapped file. */
+struct mapping
+{
+  struct list_elem elem;
+  mapid_t mapid;
+  struct file *file;        /* Opened separately from the fd, so that
+                               closing the fd leaves the mapping. */
+  uint8_t *addr;            /* First mapped page. */
+  size_t page_cnt;          /* Number of mapped pages. */
+};
+
+/* Cache of mapping structs. */
+static struct kmem_cache mapping_cache;
+#endif
+
 static void syscall_handler (struct intr_frame *);
 
 static void (*syscall_handlers[SYSCALL_COUNT]) (struct intr_frame *);
@@ -36,6 +60,7 @@ static void sys_halt_handle (struct intr_frame *);
 static void sys_exit_handle (struct intr_frame *);
 static void sys_exec_handle (struct intr_frame *);
 static void sys_wait_handle (struct intr_frame *);
+static void sys_fork_handle (struct intr_frame *);
 
 static void sys_create_handle (struct intr_frame *);
 static void sys_remove_handle (struct intr_frame *);
@@ -46,6 +71,14 @@ static void sys_write_handle (struct intr_frame *);
 static void sys_seek_handle (struct intr_frame *);
 static void sys_tell_handle (struct intr_frame *);
 static void sys_close_handle (struct intr_frame *);
+static void sys_preallocate_handle (struct intr_frame *);
+#ifdef VM
+static void sys_mmap_handle (struct intr_frame *);
+static void sys_munmap_handle (struct intr_frame *);
+
+static void munmap (mapid_t);
+static void unmap (struct mapping *);
+#endif
 
 static int get_user (const uint8_t *uaddr);
 static bool put_user (uint8_t *udst, uint8_t byte);
@@ -61,7 +94,14 @@ syscall_init (void)
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 
   lock_init (&fid_lock); /* Initialize fid lock. */
+  lock_set_name (&fid_lock, "fid");
   lock_init (&files_list_lock);
+  lock_set_name (&files_list_lock, "files_list");
+  kmem_cache_init (&file_elem_cache, "file_elem", sizeof (struct file_elem),
+                   NULL);
+#ifdef VM
+  kmem_cache_init (&mapping_cache, "mapping", sizeof (struct mapping), NULL);
+#endif
 
   /* Initialize system calls function pointers. */
   syscall_handlers[SYS_HALT]     = &sys_halt_handle;
@@ -69,6 +109,7 @@ syscall_init (void)
   syscall_handlers[SYS_EXIT]     = &sys_exit_handle;
   syscall_handlers[SYS_EXEC]     = &sys_exec_handle;
   syscall_handlers[SYS_WAIT]     = &sys_wait_handle;
+  syscall_handlers[SYS_FORK]     = &sys_fork_handle;
 
   syscall_handlers[SYS_CREATE]   = &sys_create_handle;
   syscall_handlers[SYS_REMOVE]   = &sys_remove_handle;
@@ -79,6 +120,11 @@ syscall_init (void)
   syscall_handlers[SYS_SEEK]     = &sys_seek_handle;
   syscall_handlers[SYS_TELL]     = &sys_tell_handle;
   syscall_handlers[SYS_CLOSE]    = &sys_close_handle;
+  syscall_handlers[SYS_PREALLOCATE] = &sys_preallocate_handle;
+#ifdef VM
+  syscall_handlers[SYS_MMAP]     = &sys_mmap_handle;
+  syscall_handlers[SYS_MUNMAP]   = &sys_munmap_handle;
+#endif
 }
 
 static void
@@ -96,6 +142,13 @@ exit (int status)
   struct list* process_file_list = &(proc->files);
   struct list_elem *next;
 
+#ifdef VM
+  /* Write modified mapped pages back before their files close. */
+  while (!list_empty (&proc->mappings))
+    unmap (list_entry (list_pop_front (&proc->mappings),
+                       struct mapping, elem));
+#endif
+
   while (!list_empty (process_file_list))
     {
       struct list_elem *l = list_begin ((process_file_list));
@@ -140,6 +193,12 @@ sys_wait_handle (struct intr_frame *f)
   f->eax = process_wait (pid);
 }
 
+static void
+sys_fork_handle (struct intr_frame *f)
+{
+  f->eax = process_fork (f);
+}
+
 static void
 sys_create_handle (struct intr_frame *f)
 {
@@ -191,7 +250,7 @@ sys_open_handle (struct intr_frame *f)
   if (!file_ptr)
      return;
 
-  struct file_elem *elem = (struct file_elem *) malloc (sizeof (struct file_elem));
+  struct file_elem *elem = kmem_cache_alloc (&file_elem_cache);
   elem->data = file_ptr;
   elem->fid = allocate_fid ();
   struct process *p = get_process (thread_tid ());
@@ -354,10 +413,54 @@ close (int fd)
       file_close (fil->data);
       filesys_release_external_lock ();
       list_remove (&(fil->elem));
-      free (fil);
+      kmem_cache_free (&file_elem_cache, fil);
    }
 }
 
+/* Copies the open files in list FROM into list TO, for fork().
+   Each copy keeps its descriptor and file position but is a
+   separate struct file.  Returns false, leaving TO empty, if
+   memory is exhausted. */
+bool
+dup_files (struct list *from, struct list *to)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (from); e != list_end (from); e = list_next (e))
+    {
+      struct file_elem *fe = list_entry (e, struct file_elem, elem);
+      struct file_elem *copy = kmem_cache_alloc (&file_elem_cache);
+
+      if (copy == NULL)
+        goto fail;
+      filesys_acquire_external_lock ();
+      copy->data = file_reopen (fe->data);
+      if (copy->data != NULL)
+        file_seek (copy->data, file_tell (fe->data));
+      filesys_release_external_lock ();
+      if (copy->data == NULL)
+        {
+          kmem_cache_free (&file_elem_cache, copy);
+          goto fail;
+        }
+      copy->fid = fe->fid;
+      list_push_back (to, &copy->elem);
+    }
+  return true;
+
+fail:
+  while (!list_empty (to))
+    {
+      struct file_elem *fe = list_entry (list_pop_front (to),
+                                         struct file_elem, elem);
+      filesys_acquire_external_lock ();
+      file_close (fe->data);
+      filesys_release_external_lock ();
+      kmem_cache_free (&file_elem_cache, fe);
+    }
+  return false;
+}
+
 static void
 sys_close_handle (struct intr_frame *f)
 {
@@ -365,10 +468,143 @@ sys_close_handle (struct intr_frame *f)
   close (fd);
 }
 
+static void
+sys_preallocate_handle (struct intr_frame *f)
+{
+  int fd = get_user_four_byte (f->esp + 4);
+  off_t length = (off_t) get_user_four_byte (f->esp + 8);
+  struct file_elem *file_object = get_file (fd);
+
+  f->eax = false;
+  if (file_object == NULL || file_object->data == NULL || length < 0)
+    return;
+
+  filesys_acquire_external_lock ();
+  f->eax = file_preallocate (file_object->data, length);
+  filesys_release_external_lock ();
+}
+
+#ifdef VM
+static void
+sys_mmap_handle (struct intr_frame *f)
+{
+  int fd = get_user_four_byte (f->esp + 4);
+  uint8_t *addr = (uint8_t *) get_user_four_byte (f->esp + 8);
+  struct file_elem *file_object;
+  struct mapping *m;
+  off_t length;
+  size_t i;
+
+  f->eax = -1; /* error value, will be overwritten in case of succ */
+
+  if (addr == NULL || pg_ofs (addr) != 0 || !is_user_vaddr (addr))
+    return;
+
+  file_object = get_file (fd);
+  if (file_object == NULL || file_object->data == NULL)
+    return;
+
+  filesys_acquire_external_lock ();
+  length = file_length (file_object->data);
+  filesys_release_external_lock ();
+  if (length <= 0 || (size_t) length > (size_t) ((uint8_t *) PHYS_BASE - addr))
+    return;
+
+  /* The stack area is reserved for stack growth.  It is at the top
+     of user memory, so checking the last page is enough. */
+  if (page_in_stack_area (pg_round_down (addr + length - 1)))
+    return;
+
+  m = kmem_cache_alloc (&mapping_cache);
+  if (m == NULL)
+    return;
+  filesys_acquire_external_lock ();
+  m->file = file_reopen (file_object->data);
+  filesys_release_external_lock ();
+  if (m->file == NULL)
+    {
+      kmem_cache_free (&mapping_cache, m);
+      return;
+    }
+  m->addr = addr;
+  m->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+
+  /* Pages are only recorded here, and read in as they are
+     touched.  This fails if the mapping overlaps any page already
+     in use. */
+  for (i = 0; i < m->page_cnt; i++)
+    {
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (!page_add_mmap (addr + ofs, m->file, ofs, read_bytes))
+        {
+          m->page_cnt = i;
+          unmap (m);
+          return;
+        }
+    }
+
+  /* Mapping ids come from the same counter as file descriptors. */
+  m->mapid = allocate_fid ();
+  list_push_back (&get_process (thread_tid ())->mappings, &m->elem);
+  f->eax = m->mapid;
+}
+
+static void
+sys_munmap_handle (struct intr_frame *f)
+{
+  mapid_t mapid = get_user_four_byte (f->esp + 4);
+  munmap (mapid);
+}
+
+/* Unmaps the running process's mapping MAPID, if it exists. */
+static void
+munmap (mapid_t mapid)
+{
+  struct list *mappings = &get_process (thread_tid ())->mappings;
+  struct list_elem *e;
+
+  for (e = list_begin (mappings); e != list_end (mappings); e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->mapid == mapid)
+        {
+          list_remove (e);
+          unmap (m);
+          return;
+        }
+    }
+}
+
+/* Removes the pages of mapping M, which must not be in a list,
+   writing modified ones back to its file, then closes the file
+   and frees M. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (m->addr + i * PGSIZE);
+
+  filesys_acquire_external_lock ();
+  file_close (m->file);
+  filesys_release_external_lock ();
+  kmem_cache_free (&mapping_cache, m);
+}
+#endif
+
 static void
 syscall_handler (struct intr_frame *f)
 {
+#ifdef VM
+  thread_current ()->user_esp = f->esp;
+#endif
   int syscall_key = get_user_four_byte (f->esp);
+  if (syscall_key < 0 || syscall_key >= SYSCALL_COUNT
+      || syscall_handlers[syscall_key] == NULL)
+    exit (-1);
   syscall_handlers[syscall_key] (f);
 }
 
@@ -1,8 +1,12 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <list.h>
+#include <stdbool.h>
+
 void syscall_init (void);
 void exit (int);
 void close (int);
+bool dup_files (struct list *from, struct list *to);
 
 #endif /* userprog/syscall.h */
@@ -0,0 +1,512 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/kmem.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Frame table.
+
+   Every frame taken from the user pool for a user page is
+   recorded here, so that when the user pool runs out a frame can
+   be taken away from the page that holds it.  The victim is
+   chosen with the clock (second chance) algorithm: a hand sweeps
+   the table in order, clearing the accessed bits of the pages in
+   each frame it passes over, and stops at the first frame none of
+   whose pages has been accessed since the hand last passed it.
+
+   A frame shared copy-on-write by several pages is only evicted
+   if it can be dropped without writing it to swap, because a swap
+   slot belongs to a single page.
+
+   Frames holding read-only pages of files, in practice the code
+   of executables, are also entered in shared_frames under the
+   file's inode, the page's offset and the number of bytes read
+   from the file, since two segments may end on the same page with
+   different zero padding.  A process that faults on the same page
+   of the same file maps the existing frame instead
+   of reading its own copy, so every process running a program
+   shares one copy of its code.  Such a frame is taken out of
+   shared_frames when it is evicted or when its last page is
+   unmapped.
+
+   frame_lock protects the table and is held across an eviction,
+   including any swap I/O, so that a process that faults on a
+   page being evicted waits until the page is fully written out.
+   It is never held while reading a file, and it may be acquired
+   with the file system lock held. */
+
+static struct list frame_table;     /* All frames, in clock order. */
+static struct list_elem *hand;      /* Clock hand. */
+static struct lock frame_lock;      /* Protects frame_table and hand. */
+static struct kmem_cache frame_cache;
+static struct hash shared_frames;   /* Shareable frames by file page. */
+
+/* Statistics. */
+static size_t frame_cnt;            /* # of frames in use. */
+static long long eviction_cnt;      /* # of frames evicted. */
+static long long cow_copy_cnt;      /* # of frames copied on write. */
+static long long share_cnt;         /* # of pages mapped to shared frames. */
+
+static struct frame *get_frame (enum palloc_flags);
+static void release_frame (struct frame *);
+static void add_page (struct frame *, struct page *);
+static struct frame *choose_victim (void);
+static bool test_and_clear_accessed (struct frame *);
+static bool needs_swap (struct frame *);
+static bool evict_frame (struct frame *);
+static void unpublish (struct frame *);
+static hash_hash_func frame_hash;
+static hash_less_func frame_less;
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  list_init (&frame_table);
+  hand = list_end (&frame_table);
+  lock_init (&frame_lock);
+  kmem_cache_init (&frame_cache, "frame", sizeof (struct frame), NULL);
+  if (!hash_init (&shared_frames, frame_hash, frame_less, NULL))
+    PANIC ("frame_init: out of memory");
+}
+
+/* Obtains a frame from the user pool to hold page P of the
+   running thread and records it in P, evicting other pages if
+   the pool is empty.  FLAGS are passed to palloc_get_page();
+   PAL_ZERO is honored for evicted frames too.  The frame is
+   returned pinned, so that it is not evicted before the caller
+   has filled it and mapped it; the caller must then unpin it with
+   frame_unpin().  Returns a null pointer if no frame can be
+   obtained. */
+struct frame *
+frame_alloc (struct page *p, enum palloc_flags flags)
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = get_frame (flags);
+  if (f != NULL)
+    add_page (f, p);
+  lock_release (&frame_lock);
+  return f;
+}
+
+/* Keeps the frame holding page P of the running thread from being
+   evicted, and returns it.  Returns a null pointer if P is not in
+   a frame.  Pins nest, since the frame may be shared with pages of
+   other processes that pin it too. */
+struct frame *
+frame_pin (struct page *p)
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = p->frame;
+  if (f != NULL)
+    f->pin_cnt++;
+  lock_release (&frame_lock);
+  return f;
+}
+
+/* Drops a pin on frame F, allowing it to be evicted once no pins
+   are left. */
+void
+frame_unpin (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  ASSERT (f->pin_cnt > 0);
+  f->pin_cnt--;
+  lock_release (&frame_lock);
+}
+
+/* If page P of the running thread is in a frame, unmaps it and
+   takes it out of the frame, returning the frame to the user
+   pool if no other page shares it.  PINNED says whether the
+   caller holds a pin on the frame, which is dropped; pins held by
+   other pages sharing the frame are left alone.  P's frame is
+   examined with the frame table locked, because another thread
+   may be evicting P. */
+void
+frame_free (struct page *p, bool pinned)
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = p->frame;
+  if (f != NULL)
+    {
+      pagedir_clear_page (p->owner->pagedir, p->upage);
+      list_remove (&p->frame_elem);
+      p->frame = NULL;
+      if (list_empty (&f->pages))
+        release_frame (f);
+      else if (pinned)
+        {
+          ASSERT (f->pin_cnt > 0);
+          f->pin_cnt--;
+        }
+    }
+  lock_release (&frame_lock);
+}
+
+/* Gives CHILD, the running thread's copy of page PARENT being
+   made by fork(), the same contents as PARENT.  If PARENT is in
+   a frame, CHILD shares it and both are mapped read-only until
+   one of them is written.  If PARENT is in swap, CHILD gets a
+   private copy in memory.  Otherwise PARENT's contents are still
+   its initial ones, and CHILD will load them itself.  Returns
+   false if memory is exhausted.  PARENT's thread must be blocked
+   in fork(). */
+bool
+frame_fork (struct page *parent, struct page *child)
+{
+  uint32_t *pd = child->owner->pagedir;
+  struct frame *f;
+  bool success = true;
+
+  lock_acquire (&frame_lock);
+  f = parent->frame;
+  if (f != NULL)
+    {
+      uint32_t *parent_pd = parent->owner->pagedir;
+
+      if (pagedir_is_dirty (parent_pd, parent->upage))
+        parent->dirty = true;
+      child->dirty = parent->dirty;
+      if (pagedir_set_page (pd, child->upage, f->kpage, false))
+        {
+          pagedir_set_writable (parent_pd, parent->upage, false);
+          add_page (f, child);
+        }
+      else
+        success = false;
+    }
+  else if (parent->swap_slot != SWAP_ERROR)
+    {
+      f = get_frame (0);
+      if (f != NULL
+          && pagedir_set_page (pd, child->upage, f->kpage, child->writable))
+        {
+          swap_in (parent->swap_slot, f->kpage);
+          add_page (f, child);
+          child->dirty = true;
+          f->pin_cnt--;
+        }
+      else
+        {
+          if (f != NULL)
+            release_frame (f);
+          success = false;
+        }
+    }
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* Makes page P of the running thread, which the process tried to
+   write, writable.  If P shares its frame with other pages, P
+   first gets a copy of the frame for itself.  Returns false if
+   memory is exhausted. */
+bool
+frame_unshare (struct page *p)
+{
+  uint32_t *pd = p->owner->pagedir;
+  struct frame *f, *copy;
+  bool success = true;
+
+  lock_acquire (&frame_lock);
+  f = p->frame;
+  if (f == NULL)
+    {
+      /* Evicted since the fault.  Retrying the access will fault
+         it back in, writable. */
+    }
+  else if (list_size (&f->pages) == 1)
+    pagedir_set_writable (pd, p->upage, true);
+  else
+    {
+      /* Keep F from being chosen to make room for its own copy. */
+      f->pin_cnt++;
+      copy = get_frame (0);
+      f->pin_cnt--;
+
+      if (copy != NULL)
+        {
+          memcpy (copy->kpage, f->kpage, PGSIZE);
+          pagedir_clear_page (pd, p->upage);
+          list_remove (&p->frame_elem);
+          add_page (copy, p);
+          p->dirty = true;
+          pagedir_set_page (pd, p->upage, copy->kpage, true);
+          copy->pin_cnt--;
+          cow_copy_cnt++;
+        }
+      else
+        success = false;
+    }
+  lock_release (&frame_lock);
+  return success;
+}
+
+/* If another process has page P's read-only file page in a
+   frame, maps P to that frame in the running thread and returns
+   true.  Otherwise returns false, and P must be loaded into a
+   frame of its own. */
+bool
+frame_share (struct page *p)
+{
+  struct frame key;
+  struct frame *f = NULL;
+  struct hash_elem *e;
+
+  ASSERT (!p->writable && p->file != NULL);
+
+  key.inode = file_get_inode (p->file);
+  key.ofs = p->file_ofs;
+  key.read_bytes = p->read_bytes;
+  lock_acquire (&frame_lock);
+  e = hash_find (&shared_frames, &key.hash_elem);
+  if (e != NULL)
+    {
+      f = hash_entry (e, struct frame, hash_elem);
+      if (pagedir_set_page (p->owner->pagedir, p->upage, f->kpage, false))
+        {
+          add_page (f, p);
+          share_cnt++;
+        }
+      else
+        f = NULL;
+    }
+  lock_release (&frame_lock);
+  return f != NULL;
+}
+
+/* Makes frame F, which holds read-only file page P just loaded
+   by the running thread, available to frame_share().  Must be
+   called before F is unpinned. */
+void
+frame_publish (struct frame *f, struct page *p)
+{
+  ASSERT (!p->writable && p->file != NULL);
+  ASSERT (f->pin_cnt > 0);
+
+  lock_acquire (&frame_lock);
+  f->inode = file_get_inode (p->file);
+  f->ofs = p->file_ofs;
+  f->read_bytes = p->read_bytes;
+  if (hash_insert (&shared_frames, &f->hash_elem) != NULL)
+    {
+      /* Another process loaded the same page at the same time.
+         Keep ours private. */
+      f->inode = NULL;
+    }
+  lock_release (&frame_lock);
+}
+
+/* Returns a pinned frame that holds no pages, allocating it from
+   the user pool with FLAGS or, if the pool is empty, evicting the
+   pages in another frame.  Returns a null pointer if no frame can
+   be obtained. */
+static struct frame *
+get_frame (enum palloc_flags flags)
+{
+  struct frame *f;
+  void *kpage;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  kpage = palloc_get_page (PAL_USER | flags);
+  if (kpage != NULL)
+    {
+      f = kmem_cache_alloc (&frame_cache);
+      if (f == NULL)
+        {
+          palloc_free_page (kpage);
+          return NULL;
+        }
+      f->kpage = kpage;
+      list_init (&f->pages);
+      f->inode = NULL;
+      list_insert (hand, &f->elem);
+      frame_cnt++;
+    }
+  else
+    {
+      /* Take a frame away from its pages, reusing its struct
+         frame in place in the table. */
+      f = choose_victim ();
+      if (f == NULL || !evict_frame (f))
+        return NULL;
+      unpublish (f);
+      eviction_cnt++;
+      if (flags & PAL_ZERO)
+        memset (f->kpage, 0, PGSIZE);
+    }
+  f->pin_cnt = 1;
+  return f;
+}
+
+/* Removes frame F, which must hold no pages, from the frame
+   table and returns it to the user pool. */
+static void
+release_frame (struct frame *f)
+{
+  ASSERT (list_empty (&f->pages));
+
+  unpublish (f);
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  frame_cnt--;
+  palloc_free_page (f->kpage);
+  kmem_cache_free (&frame_cache, f);
+}
+
+/* Records that frame F holds page P. */
+static void
+add_page (struct frame *f, struct page *p)
+{
+  list_push_back (&f->pages, &p->frame_elem);
+  p->frame = f;
+}
+
+/* Advances the clock hand to a frame to evict and returns it,
+   or returns a null pointer if no frame can be evicted.  Two
+   trips around the table are enough, because the first clears
+   every accessed bit it passes. */
+static struct frame *
+choose_victim (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  for (i = 0; i < 2 * frame_cnt; i++)
+    {
+      struct frame *f;
+
+      if (hand == list_end (&frame_table))
+        hand = list_begin (&frame_table);
+      f = list_entry (hand, struct frame, elem);
+      hand = list_next (hand);
+
+      if (f->pin_cnt > 0 || test_and_clear_accessed (f))
+        continue;
+      if (list_size (&f->pages) > 1 && needs_swap (f))
+        continue;
+      return f;
+    }
+  return NULL;
+}
+
+/* Returns true if any page in frame F has been accessed since
+   the last call, and clears their accessed bits. */
+static bool
+test_and_clear_accessed (struct frame *f)
+{
+  bool accessed = false;
+  struct list_elem *e;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      uint32_t *pd = p->owner->pagedir;
+
+      if (pagedir_is_accessed (pd, p->upage))
+        {
+          pagedir_set_accessed (pd, p->upage, false);
+          accessed = true;
+        }
+    }
+  return accessed;
+}
+
+/* Returns true if frame F holds a page that has been modified,
+   so that evicting F would mean writing it to swap.  Only
+   meaningful for a shared frame, which is mapped read-only and
+   so cannot become dirty while we look. */
+static bool
+needs_swap (struct frame *f)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+
+      if (p->dirty || pagedir_is_dirty (p->owner->pagedir, p->upage))
+        return true;
+    }
+  return false;
+}
+
+/* Evicts every page in frame F, leaving it empty.  Returns false
+   if a page cannot be evicted, which only happens to a page
+   alone in its frame. */
+static bool
+evict_frame (struct frame *f)
+{
+  while (!list_empty (&f->pages))
+    {
+      struct page *p = list_entry (list_front (&f->pages),
+                                   struct page, frame_elem);
+
+      if (!page_evict (p))
+        return false;
+      list_pop_front (&f->pages);
+    }
+  return true;
+}
+
+/* Takes frame F out of shared_frames, if it is there. */
+static void
+unpublish (struct frame *f)
+{
+  if (f->inode != NULL)
+    {
+      hash_delete (&shared_frames, &f->hash_elem);
+      f->inode = NULL;
+    }
+}
+
+/* Returns a hash value for shareable frame E. */
+static unsigned
+frame_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, hash_elem);
+  return (hash_bytes (&f->inode, sizeof f->inode) ^ hash_int (f->ofs)
+          ^ hash_int (f->read_bytes));
+}
+
+/* Returns true if shareable frame A precedes shareable frame B. */
+static bool
+frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, hash_elem);
+  const struct frame *b = hash_entry (b_, struct frame, hash_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frame: %zu frames in use, %lld evicted, "
+          "%lld copied on write, %lld shared\n",
+          frame_cnt, eviction_cnt, cow_copy_cnt, share_cnt);
+}
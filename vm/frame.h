@@ -0,0 +1,47 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include "filesys/off_t.h"
+#include "threads/palloc.h"
+
+struct inode;
+struct page;
+
+/* A frame of user memory holding a user page.  After fork(), the
+   parent's and child's copies of a page share one frame until
+   either writes to it, and processes running the same executable
+   share the frames of its read-only pages, so a frame may hold
+   several pages.  A frame that holds more than one page is mapped
+   read-only in all of them. */
+struct frame {
+  void *kpage;                /* Kernel virtual address. */
+  struct list pages;          /* Pages held in this frame. */
+  int pin_cnt;                /* Not to be evicted if nonzero. */
+  struct list_elem elem;      /* Element in frame table. */
+
+  /* For a frame holding a read-only file page that any process
+     mapping the same page may share: the file's inode, the
+     page's offset in it and the number of bytes read from the
+     file, the rest being zeros.  INODE is null for other
+     frames. */
+  struct inode *inode;
+  off_t ofs;
+  size_t read_bytes;
+  struct hash_elem hash_elem; /* Element in shared_frames. */
+};
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *, enum palloc_flags);
+struct frame *frame_pin (struct page *);
+void frame_unpin (struct frame *);
+void frame_free (struct page *, bool pinned);
+bool frame_fork (struct page *parent, struct page *child);
+bool frame_unshare (struct page *);
+bool frame_share (struct page *);
+void frame_publish (struct frame *, struct page *);
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,480 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   Each user process has a hash table of struct page, keyed by
+   user virtual address, in its struct thread.  load() records
+   each page of each loadable segment here instead of reading it,
+   and page_load() reads it in, from the page fault handler, the
+   first time the process touches it.
+
+   Once loaded, a page stays in its frame until the frame table
+   evicts it with page_evict().  A page that has never been
+   written is simply dropped, since its initial contents can be
+   reconstructed; any other page is written to swap, and
+   page_load() reads it back from there on the next fault.
+
+   Pages of memory-mapped files are loaded the same way, but their
+   file is the mapped file, and a modified page is written back to
+   it when it is unmapped.  Eviction also writes such a page back
+   to its file, if it can get the file system lock without
+   waiting; the frame table's lock is held at that point, and a
+   process may be faulting while holding the file system lock and
+   waiting for the frame table's lock.  Otherwise the page goes to
+   swap like any other.
+
+   fork() copies the table, and the child's copy of each loaded
+   page shares the parent's frame until one of them writes to it.
+
+   The stack starts out as the single page that load() sets up,
+   and page_grow_stack() adds zero pages below it as the process
+   touches them, down to stack_page_limit pages below PHYS_BASE.
+   Nothing else may be placed in that area.
+
+   Only the process itself adds and loads pages, but page_evict()
+   runs in whichever process needs a frame.  The frame table's
+   lock serializes the two: the fields of a page that describe
+   its current contents change only with that lock held, or while
+   the page's frame is pinned. */
+
+/* Maximum size of a user stack, in pages.  8 MB by default. */
+static size_t stack_page_limit = 2048;
+
+/* A push may fault this many bytes below the stack pointer,
+   as PUSHA, which pushes 32 bytes before moving the stack
+   pointer, does. */
+#define STACK_SLOP 32
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_free;
+static struct page *page_lookup (const void *upage);
+static bool page_create (void *upage, struct file *, off_t ofs,
+                         size_t read_bytes, bool writable, bool mapped);
+static bool write_back (struct page *, const void *kpage, bool wait);
+
+/* Initializes the running thread's supplemental page table.
+   Returns true if successful, false on memory allocation
+   failure. */
+bool
+page_table_init (void)
+{
+  struct thread *t = thread_current ();
+
+  t->exec_file = NULL;
+  return hash_init (&t->pages, page_hash, page_less, NULL);
+}
+
+/* Destroys the running thread's supplemental page table, freeing
+   the frames and swap slots of its pages, and closes the file
+   that its pages are loaded from. */
+void
+page_table_destroy (void)
+{
+  struct thread *t = thread_current ();
+
+  hash_destroy (&t->pages, page_free);
+  if (t->exec_file != NULL)
+    {
+      filesys_acquire_external_lock ();
+      file_close (t->exec_file);
+      filesys_release_external_lock ();
+      t->exec_file = NULL;
+    }
+}
+
+/* Copies the supplemental page table of PARENT, which must be
+   blocked in fork(), into the running thread's empty table, along
+   with the contents of PARENT's pages.  The running thread's page
+   directory must already be active.  Returns false if memory is
+   exhausted, leaving a partial copy to be destroyed with
+   page_table_destroy(). */
+bool
+page_table_fork (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  struct hash_iterator i;
+
+  if (parent->exec_file != NULL)
+    {
+      filesys_acquire_external_lock ();
+      t->exec_file = file_reopen (parent->exec_file);
+      filesys_release_external_lock ();
+      if (t->exec_file == NULL)
+        return false;
+    }
+
+  hash_first (&i, &parent->pages);
+  while (hash_next (&i))
+    {
+      struct page *pp = hash_entry (hash_cur (&i), struct page, hash_elem);
+      struct page *p;
+
+      /* Memory mappings are not inherited. */
+      if (pp->mapped)
+        continue;
+
+      p = malloc (sizeof *p);
+      if (p == NULL)
+        return false;
+      p->upage = pp->upage;
+      p->owner = t;
+      p->writable = pp->writable;
+      ASSERT (pp->file == NULL || pp->file == parent->exec_file);
+      p->file = pp->file != NULL ? t->exec_file : NULL;
+      p->file_ofs = pp->file_ofs;
+      p->read_bytes = pp->read_bytes;
+      p->mapped = false;
+      p->frame = NULL;
+      p->swap_slot = SWAP_ERROR;
+      p->dirty = false;
+      hash_insert (&t->pages, &p->hash_elem);
+
+      if (!frame_fork (pp, p))
+        return false;
+    }
+  return true;
+}
+
+/* Records that user page UPAGE is to be loaded with READ_BYTES
+   bytes from FILE starting at offset OFS, followed by zeros.  If
+   READ_BYTES is 0, FILE is not used and the page is all zeros.
+   The page will be writable by the process if WRITABLE is true.
+   Returns false if UPAGE is already in the table or on memory
+   allocation failure. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  return page_create (upage, file, ofs, read_bytes, writable, false);
+}
+
+/* Records that user page UPAGE is part of a memory mapping of
+   FILE, with READ_BYTES bytes from FILE starting at offset OFS,
+   followed by zeros.  The page is writable, and if it is modified
+   those bytes are written back to FILE when it is removed with
+   page_remove().  Returns false if UPAGE is already in the table
+   or on memory allocation failure. */
+bool
+page_add_mmap (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes)
+{
+  ASSERT (file != NULL && read_bytes > 0);
+
+  return page_create (upage, file, ofs, read_bytes, true, true);
+}
+
+/* Removes the page at UPAGE, which must be in the running
+   thread's table, from its address space.  If it is a modified
+   page of a memory mapping, it is first written back to its
+   file. */
+void
+page_remove (void *upage)
+{
+  struct thread *t = thread_current ();
+  struct page *p = page_lookup (upage);
+  struct frame *f;
+
+  ASSERT (p != NULL);
+
+  f = frame_pin (p);
+  if (f != NULL)
+    {
+      if (pagedir_is_dirty (t->pagedir, p->upage))
+        p->dirty = true;
+      if (p->mapped && p->dirty)
+        write_back (p, f->kpage, true);
+      frame_free (p, true);
+    }
+  else if (p->swap_slot != SWAP_ERROR)
+    {
+      /* Not in the frame table, so no other thread will touch P
+         while we read it back. */
+      if (p->mapped)
+        {
+          void *kpage = palloc_get_page (0);
+          if (kpage != NULL)
+            {
+              swap_in (p->swap_slot, kpage);
+              write_back (p, kpage, true);
+              palloc_free_page (kpage);
+            }
+        }
+      swap_free (p->swap_slot);
+    }
+
+  hash_delete (&t->pages, &p->hash_elem);
+  free (p);
+}
+
+/* Adds a page to the running thread's table.  See page_add_file()
+   and page_add_mmap(). */
+static bool
+page_create (void *upage, struct file *file, off_t ofs,
+             size_t read_bytes, bool writable, bool mapped)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return false;
+  p->upage = upage;
+  p->owner = t;
+  p->writable = writable;
+  p->file = read_bytes > 0 ? file : NULL;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->mapped = mapped;
+  p->frame = NULL;
+  p->swap_slot = SWAP_ERROR;
+  p->dirty = false;
+
+  if (hash_insert (&t->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return false;
+    }
+  return true;
+}
+
+/* Brings in the page that contains FAULT_ADDR in the running
+   thread's address space, if the supplemental page table knows
+   about it.  Returns true if successful, false if the address is
+   not part of a known page or if memory or the disk fails. */
+bool
+page_load (const void *fault_addr)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+  struct frame *f;
+  uint8_t *kpage;
+  bool zero, shared;
+
+  if (t->pagedir == NULL || !is_user_vaddr (fault_addr))
+    return false;
+  p = page_lookup (pg_round_down (fault_addr));
+  if (p == NULL)
+    return false;
+
+  /* Read-only file pages are shared with any other process that
+     has the same page of the same file loaded. */
+  shared = !p->writable && p->file != NULL;
+  if (shared && frame_share (p))
+    return true;
+
+  /* If P is being evicted, this waits for the eviction to finish,
+     so P's swap slot is up to date afterward. */
+  zero = p->file == NULL && p->swap_slot == SWAP_ERROR;
+  f = frame_alloc (p, zero ? PAL_ZERO : 0);
+  if (f == NULL)
+    return false;
+  kpage = f->kpage;
+
+  if (p->swap_slot != SWAP_ERROR)
+    {
+      swap_in (p->swap_slot, kpage);
+      swap_free (p->swap_slot);
+      p->swap_slot = SWAP_ERROR;
+    }
+  else if (p->file != NULL)
+    {
+      /* The fault may have come from a system call that is in
+         the middle of a file system operation on a user buffer. */
+      bool held = filesys_external_lock_held ();
+      off_t n;
+
+      if (!held)
+        filesys_acquire_external_lock ();
+      n = file_read_at (p->file, kpage, p->read_bytes, p->file_ofs);
+      if (!held)
+        filesys_release_external_lock ();
+
+      if (n != (off_t) p->read_bytes)
+        {
+          frame_free (p, true);
+          return false;
+        }
+      memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+    }
+
+  if (!pagedir_set_page (t->pagedir, p->upage, kpage, p->writable))
+    {
+      frame_free (p, true);
+      return false;
+    }
+  if (shared)
+    frame_publish (f, p);
+  frame_unpin (f);
+  return true;
+}
+
+/* Handles an attempt to write to the present but read-only page
+   that contains FAULT_ADDR in the running thread's address space.
+   If the page is writable, and read-only only because it shares
+   its frame copy-on-write, gives it a frame of its own.  Returns
+   true if successful, false if the page really is read-only or
+   memory is exhausted. */
+bool
+page_copy_on_write (const void *fault_addr)
+{
+  struct page *p;
+
+  if (thread_current ()->pagedir == NULL || !is_user_vaddr (fault_addr))
+    return false;
+  p = page_lookup (pg_round_down (fault_addr));
+  if (p == NULL || !p->writable)
+    return false;
+  return frame_unshare (p);
+}
+
+/* Handles a fault on FAULT_ADDR, which is not part of any page in
+   the running thread's address space, if it is an access to the
+   stack.  ESP is the process's stack pointer.  An access is taken
+   to be to the stack if it is within the stack area and no more
+   than STACK_SLOP bytes below ESP; then a new zero page is added
+   for it.  Returns true if successful, false if the access is not
+   to the stack or memory is exhausted. */
+bool
+page_grow_stack (const void *fault_addr, const void *esp)
+{
+  void *upage = pg_round_down (fault_addr);
+
+  if (thread_current ()->pagedir == NULL || !page_in_stack_area (upage)
+      || (const uint8_t *) fault_addr < (const uint8_t *) esp - STACK_SLOP)
+    return false;
+  return page_add_file (upage, NULL, 0, 0, true) && page_load (upage);
+}
+
+/* Returns true if UPAGE is in the area reserved for the user
+   stack. */
+bool
+page_in_stack_area (const void *upage)
+{
+  return is_user_vaddr (upage)
+         && (size_t) ((const uint8_t *) PHYS_BASE
+                      - (const uint8_t *) upage) <= stack_page_limit * PGSIZE;
+}
+
+/* Sets the maximum size of a user stack to PAGE_CNT pages.  Set
+   at boot by the -sl option. */
+void
+page_set_stack_limit (size_t page_cnt)
+{
+  stack_page_limit = page_cnt > 0 ? page_cnt : 1;
+}
+
+/* Evicts page P from its frame, writing it to swap if its
+   contents cannot otherwise be reconstructed.  P's frame is left
+   to the caller.  Returns false, leaving P in place, if P needs
+   to be written out and swap space is full.  Must be called with
+   the frame table's lock held. */
+bool
+page_evict (struct page *p)
+{
+  uint32_t *pd = p->owner->pagedir;
+
+  ASSERT (p->frame != NULL);
+
+  /* Unmap P before looking at its dirty bit, so that OWNER cannot
+     modify it behind our back. */
+  pagedir_clear_page (pd, p->upage);
+  if (pagedir_is_dirty (pd, p->upage))
+    p->dirty = true;
+
+  if (p->dirty && p->mapped && write_back (p, p->frame->kpage, false))
+    p->dirty = false;
+  if (p->dirty)
+    {
+      p->swap_slot = swap_out (p->frame->kpage);
+      if (p->swap_slot == SWAP_ERROR)
+        {
+          pagedir_set_page (pd, p->upage, p->frame->kpage, p->writable);
+          return false;
+        }
+    }
+  p->frame = NULL;
+  return true;
+}
+
+/* Writes the contents of memory-mapped page P, at KPAGE, back to
+   P's file.  If WAIT is false, gives up and returns false if
+   another thread holds the file system lock.  Returns true if the
+   page was written. */
+static bool
+write_back (struct page *p, const void *kpage, bool wait)
+{
+  bool held = filesys_external_lock_held ();
+
+  if (!held)
+    {
+      if (wait)
+        filesys_acquire_external_lock ();
+      else if (!filesys_try_acquire_external_lock ())
+        return false;
+    }
+  file_write_at (p->file, kpage, p->read_bytes, p->file_ofs);
+  if (!held)
+    filesys_release_external_lock ();
+  return true;
+}
+
+/* Returns the page at UPAGE in the running thread's table, or a
+   null pointer if there is none. */
+static struct page *
+page_lookup (const void *upage)
+{
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = (void *) upage;
+  e = hash_find (&thread_current ()->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Returns a hash value for page E. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+
+  return a->upage < b->upage;
+}
+
+/* Frees page E along with its frame and swap slot. */
+static void
+page_free (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, hash_elem);
+
+  /* Once P is out of the frame table, no other thread can touch
+     its swap slot. */
+  frame_free (p, false);
+  if (p->swap_slot != SWAP_ERROR)
+    swap_free (p->swap_slot);
+  free (p);
+}
@@ -0,0 +1,57 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct frame;
+struct thread;
+
+/* A page of a process's virtual address space, as recorded in its
+   supplemental page table.  The page table proper only knows about
+   pages that are present in memory; this records where every
+   other user page's contents come from, so that the page can be
+   brought in when it is first touched or after it has been
+   evicted. */
+struct page {
+  void *upage;                /* User virtual address. */
+  struct thread *owner;       /* Thread whose page it is. */
+  bool writable;              /* Writable by the process? */
+
+  /* Initial contents: READ_BYTES bytes from FILE at FILE_OFS,
+     followed by zeros.  FILE is null for an all-zero page. */
+  struct file *file;
+  off_t file_ofs;
+  size_t read_bytes;
+  bool mapped;                /* Memory-mapped, written back to FILE? */
+
+  /* Current contents. */
+  struct frame *frame;        /* Frame holding the page, if loaded. */
+  struct list_elem frame_elem; /* Element in frame's pages list. */
+  size_t swap_slot;           /* Swap slot holding it, or SWAP_ERROR. */
+  bool dirty;                 /* Differs from its initial contents? */
+
+  struct hash_elem hash_elem; /* Element in thread's pages table. */
+};
+
+bool page_table_init (void);
+void page_table_destroy (void);
+bool page_table_fork (struct thread *parent);
+
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_mmap (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes);
+void page_remove (void *upage);
+bool page_load (const void *fault_addr);
+bool page_copy_on_write (const void *fault_addr);
+bool page_grow_stack (const void *fault_addr, const void *esp);
+bool page_in_stack_area (const void *upage);
+void page_set_stack_limit (size_t page_cnt);
+bool page_evict (struct page *);
+
+#endif /* vm/page.h */